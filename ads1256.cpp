@@ -0,0 +1,1117 @@
+#include <cstring>
+#include <cmath>
+#include <numeric>
+#include <iostream>
+#include <regex>
+#include <algorithm>
+#include <chrono>
+
+#include "ads1256.h"
+
+using namespace std;
+
+const ADS1256::AdcGainInfo ADS1256::gainInfo[ADS1256::GAIN_NUM] = {
+  { GAIN_1,   1 },
+  { GAIN_2,   2 },
+  { GAIN_4,   4 },
+  { GAIN_8,   8 },
+  { GAIN_16, 16 },
+  { GAIN_32, 32 },
+  { GAIN_64, 64 }
+};
+
+const ADS1256::AdcDrateInfo ADS1256::drateInfo[ADS1256::SPS_MAX] = {
+//   idx         val  regval   t18    t19
+  { SPS_30000, 30000, 0xF0,    210,    229 },
+  { SPS_15000, 15000, 0xE0,    250,    262 },
+  { SPS_7500,   7500, 0xD0,    310,    329 },
+  { SPS_3750,   3750, 0xC0,    440,    462 },
+  { SPS_2000,   2000, 0xB0,    680,    695 },
+  { SPS_1000,   1000, 0xA1,   1180,   1195 },
+  { SPS_500,     500, 0x92,   2180,   2193 },
+  { SPS_100,     100, 0x82,  10180,  10204 },
+  { SPS_60,       60, 0x72,  16840,  16949 },
+  { SPS_50,       50, 0x63,  20180,  20000 },
+  { SPS_30,       30, 0x53,  33510,  33333 },
+  { SPS_25,       25, 0x43,  40180,  40000 },
+  { SPS_15,       15, 0x33,  66840,  66667 },
+  { SPS_10,       10, 0x23, 100180, 100000 },
+  { SPS_5,         5, 0x13, 200180, 200000 },
+  { SPS_2d5,       2, 0x03, 400180, 400000 } // really 2.5
+};
+
+const uint8_t ADS1256::regMasks[ADS1256::REG_NUM] = {
+  0x0E, // STATUS: ID and DRDY are read-only
+  0xFF, // MUX
+  0x7F, // ADCON: bit 7 reserved
+  0xFF, // DRATE
+  0xF0, // IO: only DIR bits, DIO depends on pins
+  0xFF, 0xFF, 0xFF, // OFC
+  0xFF, 0xFF, 0xFF  // FSC
+};
+
+
+ADS1256::ADS1256()
+{
+  volts.reserve( 32 );
+  volts.assign( 32, 0.0 );
+  memset( reg_shadow, 0, sizeof(reg_shadow) );
+}
+
+
+ADS1256::AdcGain ADS1256::findGain( int g )
+{
+  for( auto v : ADS1256::gainInfo ) {
+    if( v.val == g ) {
+      return v.idx;
+    }
+  }
+  return GAIN_NUM;
+}
+
+ADS1256::AdcGain ADS1256::findGainSpec( const string &s )
+{
+  if( s == "a" || s == "auto" ) {
+    return GAIN_AUTO;
+  }
+  if( s.empty() || s.find_first_not_of( "0123456789" ) != string::npos ) {
+    return GAIN_NUM;
+  }
+  return findGain( stoi( s ) );
+}
+
+ADS1256::Drate  ADS1256::findDrate( int sps )
+{
+  for( auto v : drateInfo ) {
+    if( v.val == sps ) {
+      return v.idx;
+    }
+  }
+  return SPS_MAX;
+}
+
+
+int ADS1256::calc_muxs_n( int n )
+{
+  if( n > (int)ch_max ) {
+    n = ch_max;
+  }
+  muxs.clear(); ch_gains.clear(); ch_divs.clear();
+  scan_fn = &ADS1256::measureLineN;
+  for( int i=0; i<n; ++i ) {
+    uint8_t m = calc_reg_mux( (uint8_t)(i), 0xFF );
+    if( m != 0xFF ) {
+      muxs.emplace_back( m );
+    }
+  }
+  ch_gains.assign( muxs.size(), GAIN_NUM );
+  ch_divs.assign( muxs.size(), 1 );
+  clear();
+  return muxs.size();
+}
+
+int ADS1256::calc_muxs_spec( const string &spec )
+{
+  muxs.clear(); ch_gains.clear(); ch_divs.clear();
+  scan_fn = &ADS1256::measureLineN;
+  if( spec.empty() ) {
+    return 0;
+  }
+  regex decuns( "^\\d+$" );
+  regex decdiff( "^(\\d+)-(\\d+)$" );
+  regex decrange( "^(\\d+):(\\d+)$" );
+
+  bool need_next = true;
+  string badstr;
+  for( auto c = spec.cbegin(); need_next;  ) {
+    auto f = find( c, spec.cend(), ',' );
+    if( f == spec.cend() ) {
+      need_next = false;
+    }
+    string t1 ( c, f );
+    smatch sm;
+    unsigned dv = 1; // "ch/div": measure every div line
+    auto sl = t1.find( '/' );
+    if( sl != string::npos ) {
+      const string ds = t1.substr( sl+1 );
+      if( ! regex_search( ds, decuns ) || ( dv = stoul( ds ) ) < 1 || dv > sched_max_lines ) {
+        badstr = t1; break;
+      }
+      t1.resize( sl );
+    }
+    AdcGain g = GAIN_NUM; // "ch@gain": per channel gain
+    auto at = t1.find( '@' );
+    if( at != string::npos ) {
+      g = findGainSpec( t1.substr( at+1 ) );
+      if( g == GAIN_NUM ) {
+        badstr = t1; break;
+      }
+      t1.resize( at );
+    }
+    // cerr << t1 << endl;
+    if( regex_search( t1, decuns ) ) {
+      int ch1 = stoi( t1, nullptr, 0 );
+      // cout << " ch1= " << ch1;
+      uint8_t m = calc_reg_mux( (uint8_t)(ch1), 0xFF );
+      if( m != 0xFF ) {
+        muxs.emplace_back( m );
+      } else {
+        badstr = t1; break;
+      };
+    } else if( regex_search( t1, sm, decdiff ) ) {
+      int ch1 = stoi( sm[1], nullptr, 0 );
+      int ch2 = stoi( sm[2], nullptr, 0 );
+      // cout << " ch1= " << ch1 << " ch2= " << ch2;
+      uint8_t m = calc_reg_mux( (uint8_t)(ch1), (uint8_t)(ch2) );
+      if( m != 0xFF ) {
+        muxs.emplace_back( m );
+      } else {
+        badstr = t1; break;
+      };
+    } else if( regex_search( t1, sm, decrange ) ) {
+      int ch1 = stoi( sm[1], nullptr, 0 );
+      int ch2 = stoi( sm[2], nullptr, 0 );
+      // cout << " ch1= " << ch1 << " ch2= " << ch2;
+      for( int c = ch1; c <= ch2 && badstr.empty(); ++c ) {
+        uint8_t m = calc_reg_mux( (uint8_t)(c), 0xFF );
+        if( m != 0xFF ) {
+          muxs.emplace_back( m );
+        } else {
+          badstr = t1; break;
+        };
+      }
+    } else {
+      badstr = t1; break;
+    }
+    ch_gains.resize( muxs.size(), g );
+    ch_divs.resize( muxs.size(), dv );
+    ++f; c = f;
+    // cerr << endl;
+  }
+
+  if( ! badstr.empty() ) {
+      cerr << "Error: bad channel spec string \"" << badstr << "\"" << endl;
+      muxs.clear(); ch_gains.clear(); ch_divs.clear();
+      return 0;
+  }
+
+  return muxs.size();
+}
+
+
+int ADS1256::measureLineN()
+{
+  int n = 0;
+  int mc = muxs.size();
+  clear();
+  if( mc < 1 ) {
+    return 0;
+  }
+  if( mc == 1 ) {
+    return measureLine1();
+  }
+
+  CS_guard csg;
+
+  if( multi_gain ) {
+    setReg( REG_ADCON, adconVal( cur_gains[0] ) );
+  }
+  WriteReg_noCS( REG_MUX, muxs[0] );
+  bsp_DelayUS( time_postChan );
+
+  cmdSyncWakeUp();
+  sample_bad = ! WaitDRDY( data_dly );
+
+  for( int i=0; i<mc; ++i ) {
+    if( sample_bad ) { // timeout: the rest of line is lost, recovery at once
+      markLost( i ); ++n;
+      continue;
+    }
+    int j = i+1;
+    if( j >= mc ) { j  = 0; }
+    if( multi_gain ) { // value i was converted with gain, set together with its MUX
+      const AdcGain g = cur_gains[i];
+      const int32_t code = MSW_ReadCode( muxs[j], cur_gains[j] );
+      volts[i] = code * ref_volt * gainScale( g );
+      gains[i] = gainInfo[g].val;
+      if( ! sample_bad ) {
+        autoRange( i, code );
+      }
+    } else {
+      volts[i] = MSW_ReadData( muxs[j] );
+    }
+    if( sample_bad ) {
+      markLost( i );
+    }
+    ++n;
+  }
+
+  return n;
+}
+
+int ADS1256::measureLine1()
+{
+  if( muxs.size() < 1 ) {
+    return 0;
+  }
+
+  if( need_start ) {
+    if( multi_gain ) {
+      setReg( REG_ADCON, adconVal( cur_gains[0] ) );
+    }
+    WriteReg( REG_MUX, muxs[0] );
+    bsp_DelayUS( time_postChan );
+    cmdSyncWakeUp();
+    need_start = false;
+  }
+
+  sample_bad = ! WaitDRDY( data_dly );
+  if( multi_gain ) {
+    const AdcGain g = cur_gains[0];
+    int32_t code;
+    {
+      CS_guard csg;
+      code = read_code();
+    }
+    volts[0] = code * ref_volt * gainScale( g );
+    gains[0] = gainInfo[g].val;
+    if( ! sample_bad && autoRange( 0, code ) ) { // continuous conversion: restart with new gain
+      need_start = true;
+    }
+  } else {
+    volts[0] = ReadData();
+  }
+  if( sample_bad ) {
+    markLost( 0 );
+  }
+  return 1;
+}
+
+/*
+ *  name: ADS1256::buildSched
+ *  function: make multi-rate schedule: lcm(divs) lines, channel i in every
+ *            ch_divs[i] line. Phases are selected greedy (fast channels first)
+ *            to keep the number of channels (= mux switches) per line even.
+ *  The return value: 1 - ok, 0 - period is too long
+ *********************************************************************************************************
+ */
+int ADS1256::buildSched()
+{
+  const unsigned mc = muxs.size();
+  ch_divs.resize( mc, 1 );
+  ch_cnt.assign( mc, 0 );
+  sched_lines.clear(); sched_pos = 0;
+  multi_rate = false;
+  unsigned n_l = 1;
+  for( auto d : ch_divs ) {
+    multi_rate |= ( d > 1 );
+    n_l = lcm( n_l, (unsigned)(d) );
+    if( n_l > sched_max_lines ) {
+      cerr << "Error: schedule period (lcm of channel divisors) > " << sched_max_lines << " lines" << endl;
+      return 0;
+    }
+  }
+  if( ! multi_rate ) {
+    return 1;
+  }
+
+  vector<unsigned> ord( mc ), phase( mc, 0 ), load( n_l, 0 );
+  iota( ord.begin(), ord.end(), 0 );
+  stable_sort( ord.begin(), ord.end(), [this]( unsigned a, unsigned b ) { return ch_divs[a] < ch_divs[b]; } );
+  for( auto i : ord ) {
+    const unsigned d = ch_divs[i];
+    unsigned best = UINT32_MAX;
+    for( unsigned p=0; p<d; ++p ) {
+      unsigned mx = 0;
+      for( unsigned l=p; l<n_l; l+=d ) {
+        mx = max( mx, load[l] );
+      }
+      if( mx < best ) {
+        best = mx; phase[i] = p;
+      }
+    }
+    for( unsigned l=phase[i]; l<n_l; l+=d ) {
+      ++load[l];
+    }
+  }
+
+  sched_lines.resize( n_l );
+  for( unsigned l=0; l<n_l; ++l ) {
+    for( unsigned i=0; i<mc; ++i ) {
+      if( l % ch_divs[i] == phase[i] ) {
+        sched_lines[l].push_back( i );
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+ *  name: ADS1256::measureLineSched
+ *  function: measure channels of the current schedule line, other values are NaN.
+ *            The last conversion of the line is switched to the first channel
+ *            of the next line, so its MUX (and gain) write is elided there.
+ *  The return value: number of measured channels
+ *********************************************************************************************************
+ */
+int ADS1256::measureLineSched()
+{
+  const vector<uint8_t> &act = sched_lines[sched_pos];
+  if( ++sched_pos >= sched_lines.size() ) {
+    sched_pos = 0;
+  }
+  const vector<uint8_t> &nxt = sched_lines[sched_pos];
+  volts.assign( muxs.size(), NAN );
+  fill( gains.begin(), gains.end(), 0 );
+  const int mc = act.size();
+  if( mc < 1 ) {
+    return 0;
+  }
+
+  CS_guard csg;
+
+  if( multi_gain ) {
+    setReg( REG_ADCON, adconVal( cur_gains[act[0]] ) );
+  }
+  WriteReg_noCS( REG_MUX, muxs[act[0]] );
+  bsp_DelayUS( time_postChan );
+
+  cmdSyncWakeUp();
+  sample_bad = ! WaitDRDY( data_dly );
+
+  for( int k=0; k<mc; ++k ) {
+    const unsigned i = act[k];
+    if( sample_bad ) { // timeout: the rest of line is lost
+      markLost( i );
+      continue;
+    }
+    const unsigned j = ( k+1 < mc ) ? act[k+1] : ( nxt.empty() ? act[0] : nxt[0] );
+    const AdcGain g = cur_gains[i];
+    const int32_t code = MSW_ReadCode( muxs[j], multi_gain ? cur_gains[j] : GAIN_NUM );
+    volts[i] = code * ref_volt * gainScale( g );
+    gains[i] = gainInfo[g].val;
+    if( sample_bad ) {
+      markLost( i );
+      continue;
+    }
+    autoRange( i, code );
+    ++ch_cnt[i];
+  }
+
+  return mc;
+}
+
+double ADS1256::ReadData()
+{
+  CS_guard csg;
+
+  return read_pure();
+}
+
+double ADS1256::MSW_ReadData( uint8_t m )
+{
+  return MSW_ReadCode( m ) * volt_scale;
+}
+
+/*
+ *  name: ADS1256::MSW_ReadCode
+ *  function: wait DRDY, set MUX (and ADCON gain, if g < GAIN_NUM) for the next
+ *            conversion, sync, wakeup, read code of finished one.
+ *            MUX and ADCON are neighbours: both go in one WREG burst,
+ *            unchanged gain is not sent at all.
+ *  The return value: code of previous conversion
+ *********************************************************************************************************
+ */
+int32_t ADS1256::MSW_ReadCode( uint8_t m, AdcGain g )
+{
+  const int ok = WaitDRDY( data_dly );
+
+  bsp_DelayUS( time_postChan );
+
+  if( g < GAIN_NUM ) {
+    setReg( REG_ADCON, adconVal( g ) );
+  }
+  WriteReg_noCS( REG_MUX, m );
+  bsp_DelayUS( time_postChan );
+  cmdSyncWakeUp();
+
+  const int32_t code = read_code();
+  sample_bad = ! ok; // data register holds old conversion
+  return code;
+}
+
+ADS1256::AdcGain ADS1256::fitGain( uint32_t peak1 )
+{
+  for( int g = GAIN_64; g > GAIN_1; --g ) {
+    if( ( (uint64_t)(peak1) << g ) <= auto_up ) {
+      return (AdcGain)(g);
+    }
+  }
+  return GAIN_1;
+}
+
+/*
+ *  name: ADS1256::autoRange
+ *  function: watch codes of auto-ranging channel i: go down at once,
+ *            if code is near full scale (to gain 1, if clipped),
+ *            go up only after auto_win lines with small peak.
+ *            New gain is used from the next conversion of this channel.
+ *  The return value: true - gain changed
+ *********************************************************************************************************
+ */
+bool ADS1256::autoRange( unsigned i, int32_t code )
+{
+  if( ch_gains[i] != GAIN_AUTO ) {
+    return false;
+  }
+  AutoRange &a = ar[i];
+  const AdcGain g = cur_gains[i];
+  const uint32_t ac = ( code < 0 ) ? -(int64_t)(code) : code;
+  a.peak = max( a.peak, ac >> g );
+
+  AdcGain ng = g;
+  if( ac >= auto_clip ) {
+    ng = GAIN_1;
+  } else if( ac > auto_down ) {
+    ng = fitGain( ac >> g );
+  } else if( ++a.cnt >= auto_win ) {
+    ng = max( g, fitGain( a.peak ) );
+    a.peak = 0; a.cnt = 0;
+  }
+  if( ng == g ) {
+    return false;
+  }
+  cur_gains[i] = ng;
+  a.peak = 0; a.cnt = 0;
+  ++gain_switches;
+  return true;
+}
+
+/*
+ *  name: ADS1256::buildBatch
+ *  function: make parts of one line for io_xfer(): the same commands as
+ *            measureLineN, but every DRDY wait is replaced by settling time
+ *            (+1/16 for clock tolerance) in the delay of previous part
+ *  The return value: 1 - ok, 0 - settling time does not fit in part delay
+ *********************************************************************************************************
+ */
+int ADS1256::buildBatch()
+{
+  const unsigned mc = muxs.size();
+  const uint32_t settle = setting_dly + setting_dly / 16 + time_postChan;
+  batch.clear();
+  if( settle > 0xFFFF ) {
+    return 0;
+  }
+  // switch s: to muxs[0] (start), then to muxs[s % mc]; RDATA reads value s-1
+  batch_tx.resize( 6 * ( mc + 1 ) );
+  batch_rx.resize( 3 * mc );
+  batch_bytes = 0;
+  for( unsigned s=0; s<=mc; ++s ) {
+    uint8_t *t = &batch_tx[6*s];
+    t[0] = CMD_WREG | REG_MUX; t[1] = 0x00; t[2] = muxs[ s % mc ];
+    t[3] = CMD_SYNC; t[4] = CMD_WAKEUP; t[5] = CMD_RDATA;
+    batch.push_back( { t,   nullptr, 3, time_postChan, 0 } );
+    batch.push_back( { t+3, nullptr, 1, time_postChan, 0 } );
+    if( s == 0 ) {
+      batch.push_back( { t+4, nullptr, 1, (uint16_t)( settle ), 0 } );
+      batch_bytes += 5;
+      continue;
+    }
+    batch.push_back( { t+4, nullptr, 1, time_wakeup, 0 } );
+    batch.push_back( { t+5, nullptr, 1, time_delayData, 0 } );
+    // the last conversion (muxs[0]) is restarted by the next line
+    batch.push_back( { nullptr, &batch_rx[3*(s-1)], 3, (uint16_t)( s < mc ? settle : 0 ), 0 } );
+    batch_bytes += 9;
+  }
+  return 1;
+}
+
+/*
+ *  name: ADS1256::measureLineBatch
+ *  function: scan of all channels by one io_xfer() (one ioctl for spidev).
+ *            DRDY is not read: lost values are found only as stuck codes.
+ *  The return value: number of measured channels
+ *********************************************************************************************************
+ */
+int ADS1256::measureLineBatch()
+{
+  const unsigned mc = muxs.size();
+  reg_stats.wr_req += mc + 1; reg_stats.bursts += mc + 1;
+  reg_stats.bytes_naive += 3 * ( mc + 1 ); reg_stats.bytes_sent += 3 * ( mc + 1 );
+  if( ! io_xfer( batch.data(), batch.size(), batch_bytes ) ) {
+    for( unsigned i=0; i<mc; ++i ) {
+      markLost( i );
+    }
+    return mc;
+  }
+  const uint8_t *rx = batch_rx.data();
+  for( unsigned i=0; i<mc; ++i, rx += 3 ) {
+    volts[i] = decode_code( rx ) * volt_scale;
+  }
+  return mc;
+}
+
+/*
+ *  name: ADS1256::selectScan
+ *  function: select batched scan (if transport prefers it), schedule or generic scan
+ *  The return value: number of channels in batched scan, 0 - other
+ *********************************************************************************************************
+ */
+int ADS1256::selectScan()
+{
+  scan_fn = &ADS1256::measureLineN;
+  if( multi_rate ) {
+    scan_fn = &ADS1256::measureLineSched;
+    return 0;
+  }
+  if( multi_gain ) {
+    return 0;
+  }
+  if( io_mode == IO_DIRECT && io_tr->isBatched() && muxs.size() > 1 && buildBatch() ) {
+    scan_fn = &ADS1256::measureLineBatch;
+    volts.assign( muxs.size(), 0.0 );
+    return muxs.size();
+  }
+  return 0;
+}
+
+int32_t ADS1256::read_code()
+{
+  const uint8_t cmd = CMD_RDATA;
+  uint8_t buf[3];
+  const IoXfer x[2] = { { &cmd, nullptr, 1, time_delayData, 0 }, { nullptr, buf, 3, 0, 0 } };
+  bsp_DelayUS( time_send );
+  io_cmd( x, 2 ); // RDATA, t6 (time_delayData), 3 bytes: one command for transport
+
+  return decode_code( buf );
+}
+
+int32_t ADS1256::decode_code( const uint8_t *buf )
+{
+  uint32_t
+  read  =  ( (uint32_t)buf[0] << 16 ) & 0x00FF0000;
+  read |=  ( (uint32_t)buf[1] <<  8 );
+  read |=  buf[2];
+
+  ++line_codes; // stuck MISO: the same all-0 or all-1 code for every channel
+  stuck_ones  += ( read == 0x00FFFFFF );
+  stuck_zeros += ( read == 0 );
+  if( read == 0 || read == 0x00FFFFFF ) { // or for stuck_run_max codes in a row
+    stuck_run = ( read == stuck_code ) ? stuck_run + 1 : 1;
+    stuck_code = read;
+  } else {
+    stuck_run = 0;
+  }
+
+  if( read & 0x800000 ) { // 24->32 bit signed
+    read |= 0xFF000000;
+  }
+
+  return (int32_t)(read);
+}
+
+
+
+void ADS1256::sendByte( uint8_t d0 )
+{
+  sendBytes( &d0, 1 );
+}
+
+void ADS1256::sendBytes( uint8_t d0, uint8_t d1 )
+{
+  const uint8_t d[2] = { d0, d1 };
+  sendBytes( d, 2 );
+}
+
+void ADS1256::sendBytes( uint8_t d0, uint8_t d1, uint8_t d2 )
+{
+  const uint8_t d[3] = { d0, d1, d2 };
+  sendBytes( d, 3 );
+}
+
+// one command: all bytes go to transport together (spidev: one ioctl)
+void ADS1256::sendBytes( const uint8_t *data, unsigned n )
+{
+  const IoXfer x = { data, nullptr, (uint16_t)( n ), 0, 0 };
+  bsp_DelayUS( time_send );
+  io_cmd( &x, 1 );
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::CfgADC
+ *  function: The configuration parameters of ADC, gain and data rate
+ *  parameter: gain:gain 1-64
+ *                      drate:  data  rate
+ *  The return value: 1 - ok, 0 - error
+ *********************************************************************************************************
+ */
+int  ADS1256::CfgADC( AdcGain gain, Drate drate )
+{
+  if( gain >= GAIN_NUM || drate >= SPS_MAX ) {
+    return 0;
+  }
+
+  Gain = gain;
+  gainval = gainInfo[gain].val;
+  updScale();
+  DataRate = drate;
+  setting_dly = drateInfo[DataRate].t18;
+  if( drate == SPS_2d5 ) {
+    data_dly = 400000;
+  } else {
+    data_dly = 1000000 / drateInfo[drate].val;
+  }
+  cerr << "# setting_dly= " << setting_dly << " data_dly= " << data_dly << endl;
+
+  // per channel gains: spec gain or global one; auto starts from 1
+  const unsigned mc = muxs.size();
+  cur_gains.resize( mc );
+  ar.assign( mc, AutoRange() );
+  ch_gains.resize( mc, GAIN_NUM );
+  multi_gain = false;
+  for( unsigned i=0; i<mc; ++i ) {
+    AdcGain g = ch_gains[i];
+    if( g == GAIN_NUM ) {
+      g = gain;
+    } else if( g == GAIN_AUTO ) {
+      g = GAIN_1;
+      ar[i].cnt = auto_win - 1; // first decision after the first line
+    }
+    cur_gains[i] = g;
+    multi_gain |= ( g != gain || ch_gains[i] == GAIN_AUTO );
+  }
+  gains.assign( mc, gainval );
+  if( ! buildSched() ) {
+    return 0;
+  }
+
+  if( ! WaitDRDY( setting_dly ) ) {
+    return 0;
+  }
+
+  // ACAL would recalibrate on every gain switch
+  const uint8_t acal = multi_gain ? 0 : 1;
+  //                BitOrder     ACAL      Buffer
+  setReg( REG_STATUS, (0 << 3) | (acal << 2) | (1 << 1) ); // TODO: buffer ctl
+  setReg( REG_MUX,    muxs[0] );
+  //                 CLKxx     SDCSx
+  setReg( REG_ADCON, (0 << 5) | (0 << 3) |  ( multi_gain ? cur_gains[0] : gain ) );
+  setReg( REG_DRATE, drateInfo[drate].regval );
+
+  int rc = flushRegs(); // 4 low regs in one burst
+
+  bsp_DelayUS( time_postcfg );
+  need_start = true; // single channel: restart continuous conversion
+  selectScan();
+  return rc;
+}
+
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::WriteReg
+ *  function: Write the corresponding register
+ *  parameter: RegID: register  ID
+ *       RegValue: register Value
+ *  The return value: NULL
+ *********************************************************************************************************
+ */
+void ADS1256::WriteReg( uint8_t RegID, uint8_t RegValue )
+{
+  setReg( RegID, RegValue );
+  flushRegs();
+}
+
+void ADS1256::WriteReg_noCS( uint8_t RegID, uint8_t RegValue )
+{
+  setReg( RegID, RegValue );
+  flushRegs_noCS();
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::setReg
+ *  function: store register value to shadow copy and mark it as dirty,
+ *            if chip may hold other value. No SPI transfers here.
+ *********************************************************************************************************
+ */
+void ADS1256::setReg( uint8_t RegID, uint8_t RegValue )
+{
+  if( RegID >= REG_NUM ) {
+    return;
+  }
+  ++reg_stats.wr_req;
+  reg_stats.bytes_naive += 3;
+  const uint16_t bit = 1u << RegID;
+  if( ( reg_known & bit ) && ! ( reg_dirty & bit ) && reg_shadow[RegID] == RegValue ) {
+    ++reg_stats.elided;
+    return;
+  }
+  reg_shadow[RegID] = RegValue;
+  reg_dirty |= bit;
+  reg_valid |= bit;
+}
+
+bool ADS1256::regsKnown( unsigned r0, unsigned r1 ) const
+{
+  for( unsigned r = r0; r < r1; ++r ) {
+    if( ! ( reg_known & ( 1u << r ) ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ADS1256::invalidateRegs( uint8_t r0, uint8_t n )
+{
+  for( unsigned r = r0; r < (unsigned)(r0+n) && r < REG_NUM; ++r ) {
+    reg_known &= ~( 1u << r );
+  }
+}
+
+int ADS1256::flushRegs()
+{
+  if( ! reg_dirty ) {
+    return 1;
+  }
+  CS_guard csg;
+  return flushRegs_noCS();
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::flushRegs_noCS
+ *  function: write dirty registers by minimal number of WREG bursts.
+ *            Small gaps of clean (known) registers are rewritten
+ *            instead of starting new burst: 2 bytes header > gap.
+ *  The return value: 1 - ok, 0 - verification failed
+ *********************************************************************************************************
+ */
+int ADS1256::flushRegs_noCS()
+{
+  int rc = 1;
+  unsigned r = 0;
+  while( reg_dirty && r < REG_NUM ) {
+    if( ! ( reg_dirty & ( 1u << r ) ) ) {
+      ++r; continue;
+    }
+    unsigned e = r; // last reg in burst
+    for( unsigned k = r+1; k < REG_NUM; ++k ) {
+      if( ! ( reg_dirty & ( 1u << k ) ) ) {
+        continue;
+      }
+      if( k - e - 1 > wreg_max_gap || ! regsKnown( e+1, k ) ) {
+        break;
+      }
+      e = k;
+    }
+
+    unsigned n = e - r + 1;
+    uint8_t buf[REG_NUM+2];
+    buf[0] = CMD_WREG | r;
+    buf[1] = n - 1;
+    memcpy( buf+2, reg_shadow+r, n );
+    sendBytes( buf, n+2 );
+    ++reg_stats.bursts;
+    reg_stats.bytes_sent += n+2;
+
+    const uint16_t bits = ( ( 1u << n ) - 1 ) << r;
+    reg_dirty &= ~bits;
+    reg_known |=  bits;
+
+    // auto-calibration (ACAL) is started by ADCON, DRATE or STATUS write
+    if( ( bits & ( ( 1u << REG_STATUS ) | ( 1u << REG_ADCON ) | ( 1u << REG_DRATE ) ) )
+        && ( reg_shadow[REG_STATUS] & 0x04 ) ) {
+      invalidateRegs( REG_OFC0, 6 );
+    }
+
+    if( reg_verify && ! verifyRegs_noCS( r, n ) ) {
+      rc = 0;
+    }
+    r = e + 1;
+  }
+  return rc;
+}
+
+int ADS1256::verifyRegs_noCS( uint8_t r0, uint8_t n )
+{
+  uint8_t buf[REG_NUM];
+  bsp_DelayUS( time_postChan );
+  ReadRegs_noCS( r0, n, buf );
+  int rc = 1;
+  for( unsigned i=0; i<n; ++i ) {
+    const uint8_t r = r0 + i;
+    if( ( buf[i] ^ reg_shadow[r] ) & regMasks[r] ) {
+      cerr << "Error: reg " << (int)r << " verify: write " << hex << (unsigned)reg_shadow[r]
+           << " read " << (unsigned)buf[i] << dec << endl;
+      ++reg_stats.verify_fail;
+      invalidateRegs( r, 1 );
+      rc = 0;
+    }
+  }
+  return rc;
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::syncRegs
+ *  function: read all registers to shadow copy, drop pending writes.
+ *            Called after reset: registers, which are never set by CfgADC
+ *            (IO, OFC, FSC), hold chip values for recover()
+ *  The return value: 1 - ok, 0 - error
+ *********************************************************************************************************
+ */
+int ADS1256::syncRegs()
+{
+  if( ! WaitDRDY( setting_dly ) ) {
+    return 0;
+  }
+  CS_guard csg;
+  ReadRegs_noCS( 0, REG_NUM, reg_shadow );
+  reg_known = reg_valid = ( 1u << REG_NUM ) - 1;
+  reg_dirty = 0;
+  return 1;
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::ReadReg
+ *  function: Read  the corresponding register
+ *  parameter: RegID: register  ID
+ *  The return value: read register value
+ *********************************************************************************************************
+ */
+uint8_t ADS1256::ReadReg( uint8_t RegID )
+{
+  CS_guard csg;
+
+  uint8_t v;
+  ReadRegs_noCS( RegID, 1, &v );
+  return v;
+}
+
+// RREG, t6 (time_delayData), n bytes: one command for transport
+void ADS1256::ReadRegs_noCS( uint8_t r0, uint8_t n, uint8_t *d )
+{
+  const uint8_t cmd[2] = { (uint8_t)( CMD_RREG | r0 ), (uint8_t)( n-1 ) };
+  const IoXfer x[2] = { { cmd, nullptr, 2, time_delayData, 0 }, { nullptr, d, n, 0, 0 } };
+  bsp_DelayUS( time_send );
+  io_cmd( x, 2 );
+}
+
+/*
+ *********************************************************************************************************
+ *  name: ADS1256::WriteCmd
+ *  function: Sending a single byte order
+ *  parameter: cmd : command
+ *********************************************************************************************************
+ */
+void ADS1256::WriteCmd( uint8_t cmd )
+{
+  CS_guard csg;
+  sendByte( cmd );
+  if( cmd == CMD_RESET ) {
+    invalidateRegs();
+  } else if( cmd >= CMD_SELFCAL && cmd <= CMD_SYSGCAL ) {
+    invalidateRegs( REG_OFC0, 6 );
+  }
+}
+
+uint8_t ADS1256::ReadChipID()
+{
+  if( ! WaitDRDY( setting_dly ) ) {
+    return 0;
+  }
+  int8_t id = ReadReg( REG_STATUS );
+  return ( id >> 4 );
+}
+
+
+/*
+ *  name: ADS1256::WaitDRDY
+ *  function: wait for data ready signal, nominal time us. Limit is real time
+ *            (IoTransport::drdyTimeoutUs: 2 * us + 1 ms): one usleep(1) of
+ *            polling takes ~60 us, counting iterations made a 2 ms wait 120 ms.
+ *            Replay takes the recorded number of level reads.
+ *  The return value:  0 - timeout, 1 = ok
+ *********************************************************************************************************
+ */
+int ADS1256::WaitDRDY( uint32_t us )
+{
+  // long waits: sleep for DRDY edge (trace needs every level read)
+  const int r = ( io_mode == IO_DIRECT ) ? io_tr->waitDrdy( us ) : -1;
+  if( r > 0 ) {
+    return 1;
+  }
+  if( io_mode == IO_REPLAY ) {
+    while( io_trace.replayHasRead() ) {
+      if( DRDY_IS_LOW() ) {
+        return 1;
+      }
+    }
+  } else if( r < 0 ) {
+    const auto t_end = chrono::steady_clock::now() + chrono::microseconds( IoTransport::drdyTimeoutUs( us ) );
+    do {
+      if( DRDY_IS_LOW() ) {
+        return 1;
+      }
+      usleep( 1 );
+    } while( chrono::steady_clock::now() < t_end );
+  }
+  if( io_mode == IO_REPLAY && io_trace.ended() ) {
+    return 0;
+  }
+  io_mark( IoTrace::MARK_DRDY_TIMEOUT );
+  telem.add( Telemetry::DRDY_TIMEOUTS );
+  cerr << "WaitDRDY() Time Out ..." << endl;
+  return 0;
+}
+
+
+void ADS1256::lineFault()
+{
+  if( io_mode == IO_REPLAY && io_trace.ended() ) {
+    return;
+  }
+  if( ! bad_mask ) { // stuck bus: every measured value of line
+    for( unsigned i=0; i<volts.size(); ++i ) {
+      if( ! std::isnan( volts[i] ) ) {
+        markLost( i );
+      }
+    }
+  }
+  const unsigned n = __builtin_popcount( bad_mask );
+  stuck_run = 0;
+  ++rec_stats.bad_lines;
+  rec_stats.lost += n;
+  telem.add( Telemetry::SAMPLES_LOST, n );
+  recover();
+}
+
+/*
+ *  name: ADS1256::recover
+ *  function: bring ADC back after DRDY timeout or stuck data:
+ *            1) SDATAC (if chip is in RDATAC mode), SYNC, WAKEUP, wait DRDY
+ *               and verify registers;
+ *            2) if not helped: RST pin pulse, write registers STATUS .. IO from
+ *               shadow (only ones read or set before), wait DRDY, verify.
+ *            Scans stop the line at the first DRDY timeout, so a line
+ *            costs at most one data wait, T(data_dly), and three waits here,
+ *            T(setting_dly), T = 2 * us + 1 ms, plus ~0.3 ms of delays: 21 ms
+ *            at 500 SPS. Measured with fake, BCM_FAKE_FAULT=200:2, 500 SPS:
+ *            10.5 ms per bad line, 5.4 ms of it here (soft wait + RST).
+ *  The return value: 1 - ok, 0 - failed (next line will try again)
+ *********************************************************************************************************
+ */
+int ADS1256::recover()
+{
+  const auto t0 = chrono::steady_clock::now();
+  io_mark( IoTrace::MARK_RECOVER, 1 );
+  {
+    CS_guard csg;
+    sendByte( CMD_SDATAC );
+    cmdSyncWakeUp();
+  }
+  int ok = WaitDRDY( setting_dly );
+  if( ok ) {
+    CS_guard csg;
+    ok = verifyRegs_noCS( REG_STATUS, 4 ); // STATUS .. DRATE
+  }
+
+  if( ok ) {
+    ++rec_stats.soft;
+  } else {
+    io_mark( IoTrace::MARK_RECOVER, 2 );
+    RST_0();
+    bsp_DelayUS( 100 );
+    RST_1();
+    invalidateRegs();
+    for( unsigned r = REG_STATUS; r <= REG_IO; ++r ) { // OFC, FSC: ACAL or power-up values
+      if( reg_valid & ( 1u << r ) ) { // never read or set: power-up value is right
+        setReg( r, reg_shadow[r] );
+      }
+    }
+    ok = WaitDRDY( setting_dly ) && flushRegs();
+    bsp_DelayUS( time_postcfg );
+    if( ok && ( ok = WaitDRDY( setting_dly ) ) ) {
+      CS_guard csg;
+      ok = verifyRegs_noCS( REG_STATUS, 4 );
+    }
+    if( ok ) {
+      ++rec_stats.hard;
+    } else {
+      ++rec_stats.failed;
+    }
+  }
+  telem.add( ok ? Telemetry::RECOVERIES : Telemetry::RECOVER_FAILED );
+
+  need_start = true;
+  rec_stats.time_ns += chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - t0 ).count();
+  return ok;
+}
+
+void ADS1256::clear()
+{
+  volts.assign( muxs.size(), 0.0 );
+}
+
+/*
+ *********************************************************************************************************
+ *  name: Write_DAC8552
+ *  function:  DAC send data
+ *  parameter: channel : output channel number
+ *         data : output DAC value
+ *  The return value:  NULL
+ *********************************************************************************************************
+ */
+// void Write_DAC8552( uint8_t channel, uint16_t Data )
+// {
+//   // uint8_t i;
+//   CS_1() ;
+//   CS_0() ;
+//   bcm2835_spi_transfer( channel);
+//   bcm2835_spi_transfer( Data>>8 );
+//   bcm2835_spi_transfer( Data&0xff );
+//   CS_1() ;
+// }
+
+/*
+ *********************************************************************************************************
+ *  name: Voltage_Convert
+ *  function:  Voltage value conversion function
+ *  parameter: Vref : The reference voltage 3.3V or 5V
+ *         voltage : output DAC value
+ *  The return value:  NULL
+ *********************************************************************************************************
+ */
+// uint16_t Voltage_Convert( float Vref, float voltage )
+// {
+//   return (uint16_t)( 65536 * voltage / Vref );
+// }
+
+int init_hw()
+{
+  if( io_mode != IO_REPLAY ) {
+    io_tr->setPins( SPICS, DRDY, RST );
+    if( ! io_tr->open() ) {
+      return 0;
+    }
+  }
+  io_gpio_write( SPICS, HIGH );
+  // Hardware reset pulse
+  io_gpio_write( RST, LOW );
+  bsp_DelayUS( 10000 );
+  io_gpio_write( RST, HIGH );
+  bsp_DelayUS( 5000 );
+  return 1;
+}
+
+void close_hw()
+{
+  if( io_mode == IO_REPLAY ) {
+    return;
+  }
+  io_tr->close();
+}
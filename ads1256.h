@@ -0,0 +1,326 @@
+#ifndef _ADS1256_H
+#define _ADS1256_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <bcm2835.h>
+
+#include "ads_trace.h"
+#include "ads_out.h"
+
+const double default_rev_v = 2.487226;
+
+#ifdef BCM_FAKE
+extern "C" int bcm_fake_delay; // bcm_fake.c: 0 - skip delays
+#endif
+
+// CS     -----   SPICS
+// DIN    -----   MOSI
+// DOUT   -----   MISO
+// SCLK   -----   SCLK
+// DRDY   -----   ctl_IO     data  starting
+// RST    -----   ctl_IO     reset
+
+
+#define  DRDY   RPI_GPIO_P1_11  // DRDY (GPIO17, pin 11)
+#define  RST    RPI_GPIO_P1_12  // RST  (GPIO18, pin 12)
+// Many ADS1256 add-on boards use CE0 (pin 24 / GPIO8) for CS; original code used pin 15.
+#define  SPICS  RPI_GPIO_P1_24  // CS (GPIO8, pin 24)
+
+inline void CS_1() { io_gpio_write( SPICS, HIGH ); }
+inline void CS_0() { io_gpio_write( SPICS, LOW );  }
+
+class CS_guard {
+  public:
+   CS_guard()  { io_gpio_write( SPICS, LOW  ); };
+   ~CS_guard() { io_gpio_write( SPICS, HIGH ); };
+};
+
+inline bool DRDY_IS_LOW() { return io_gpio_lev( DRDY ) == 0; };
+
+inline void RST_1() {  io_gpio_write( RST, HIGH ); }
+inline void RST_0() {  io_gpio_write( RST, LOW );  }
+
+inline void  bsp_DelayUS( uint64_t micros )
+{
+  if( io_mode == IO_REPLAY ) {
+    return;
+  }
+  io_tr->delayUs( micros );
+}
+
+class ADS1256 {
+  public:
+   enum AdcTimes {
+     time_send = 2,         // really 4 tau, 5.2e-7
+     time_postcfg = 50,     //
+     time_delayData  = 10,  //
+     time_postChan = 5,     //
+     time_wakeup = 25       //
+   };
+   enum AdcGain {
+     GAIN_1      = 0,
+     GAIN_2      = 1,
+     GAIN_4      = 2,
+     GAIN_8      = 3,
+     GAIN_16     = 4,
+     GAIN_32     = 5,
+     GAIN_64     = 6,
+     GAIN_NUM,   // 7
+     GAIN_AUTO   // only in channel spec: auto-ranging
+   };
+   struct AdcGainInfo {
+     AdcGain idx;
+     uint8_t val;
+   };
+   enum Drate {
+     SPS_30000 = 0,
+     SPS_15000,
+     SPS_7500,
+     SPS_3750,
+     SPS_2000,
+     SPS_1000,
+     SPS_500,
+     SPS_100,
+     SPS_60,
+     SPS_50,
+     SPS_30,
+     SPS_25,
+     SPS_15,
+     SPS_10,
+     SPS_5,
+     SPS_2d5,
+     SPS_MAX
+   };
+   struct AdcDrateInfo {
+     Drate    idx;
+     uint16_t val;
+     uint8_t  regval;
+     uint32_t t18; // setting time in us, table 13
+     uint32_t t19; // setting time in us, table 13
+   };
+
+   enum RegNum { //* Register definitions Table 23. Register Map --- ADS1256 datasheet Page 30
+                 //  Register address, followed by reset the default values
+     REG_STATUS =  0, // x1H
+     REG_MUX    =  1, // 01H
+     REG_ADCON  =  2, // 20H
+     REG_DRATE  =  3, // F0H
+     REG_IO     =  4, // E0H
+     REG_OFC0   =  5, // xxH
+     REG_OFC1   =  6, // xxH
+     REG_OFC2   =  7, // xxH
+     REG_FSC0   =  8, // xxH
+     REG_FSC1   =  9, // xxH
+     REG_FSC2   = 10, // xxH
+     REG_NUM          // 11
+   };
+
+   //* Command definitions TTable 24. Command Definitions --- ADS1256 datasheet Page 34
+   enum Commands  {
+     CMD_WAKEUP  = 0x00, //* Completes SYNC and Exits Standby Mode 0000  0000 (00h)
+     CMD_RDATA   = 0x01, //* Read Data 0000  0001 (01h)
+     CMD_RDATAC  = 0x03, //* Read Data Continuously 0000   0011 (03h)
+     CMD_SDATAC  = 0x0F, //* Stop Read Data Continuously 0000   1111 (0Fh)
+     CMD_RREG    = 0x10, //* Read from REG rrr 0001 rrrr (1xh)
+     CMD_WREG    = 0x50, //* Write to REG rrr 0101 rrrr (5xh)
+     CMD_SELFCAL = 0xF0, //* Offset and Gain Self-Calibration 1111    0000 (F0h)
+     CMD_SELFOCAL= 0xF1, //* Offset Self-Calibration 1111    0001 (F1h)
+     CMD_SELFGCAL= 0xF2, //* Gain Self-Calibration 1111    0010 (F2h)
+     CMD_SYSOCAL = 0xF3, //* System Offset Calibration 1111   0011 (F3h)
+     CMD_SYSGCAL = 0xF4, //* System Gain Calibration 1111    0100 (F4h)
+     CMD_SYNC    = 0xFC, //* Synchronize the A/D Conversion 1111   1100 (FCh)
+     CMD_STANDBY = 0xFD, //* Begin Standby Mode 1111   1101 (FDh)
+     CMD_RESET   = 0xFE, //* Reset to Power-Up Values 1111   1110 (FEh)
+   };
+
+   struct RegStats {
+     uint64_t wr_req    = 0; // setReg() calls
+     uint64_t elided    = 0; // requests not sent: value already in chip
+     uint64_t bursts    = 0; // WREG commands really sent
+     uint64_t bytes_naive = 0; // bytes, if every request was a single WREG
+     uint64_t bytes_sent  = 0; // bytes really sent by WREG bursts
+     uint64_t verify_fail = 0; // read-back mismatches
+     uint64_t bytesSaved() const { return bytes_naive - bytes_sent; }
+   };
+
+   struct RecStats {
+     uint64_t bad_lines = 0; // lines with lost values
+     uint64_t lost      = 0; // values lost
+     uint64_t soft      = 0; // recovered by SDATAC, SYNC, WAKEUP
+     uint64_t hard      = 0; // recovered by RST pin and register restore
+     uint64_t failed    = 0; // still no DRDY or bad registers
+     uint64_t time_ns   = 0; // spent in recovery
+   };
+
+   ADS1256();
+   void sendByte( uint8_t data );
+   void sendBytes( uint8_t d0, uint8_t d1 );
+   void sendBytes( uint8_t d0, uint8_t d1, uint8_t d2 );
+   void sendBytes( const uint8_t *data, unsigned n );
+   static AdcGain findGain( int g );
+   static AdcGain findGainSpec( const std::string &s ); // "1".."64", "a", "auto"
+   static Drate   findDrate( int sps );
+   static constexpr uint8_t calc_reg_mux( uint8_t c1, uint8_t c2 );
+   static constexpr double gainScale( AdcGain g ) { return 1.0 / ( ( 1 << g ) * (double)0x400000 ); }
+   int calc_muxs_n( int n );
+   int calc_muxs_spec( const std::string &spec );
+   int  CfgADC( AdcGain gain, Drate drate );
+   void WriteReg( uint8_t RegID, uint8_t RegValue );
+   void WriteReg_noCS( uint8_t RegID, uint8_t RegValue );
+   void setReg( uint8_t RegID, uint8_t RegValue ); // only shadow, real write by flushRegs
+   int  flushRegs();
+   int  flushRegs_noCS();
+   void invalidateRegs( uint8_t r0 = 0, uint8_t n = REG_NUM );
+   int  syncRegs(); // read all registers to shadow
+   void setVerify( bool v ) { reg_verify = v; }
+   const RegStats& getRegStats() const { return reg_stats; }
+   uint8_t ReadReg( uint8_t RegID );
+   void ReadRegs_noCS( uint8_t r0, uint8_t n, uint8_t *d );
+   void WriteCmd( uint8_t cmd );
+   uint8_t ReadChipID();
+   int  WaitDRDY( uint32_t us = 1000 );
+   double ReadData();
+   double MSW_ReadData( uint8_t m ); // wait, set MUX, sync, wakeup, real old data
+   int32_t MSW_ReadCode( uint8_t m, AdcGain g = GAIN_NUM ); // the same + gain of next, code
+   int measureLine() {
+     bad_mask = 0; stuck_ones = 0; stuck_zeros = 0; line_codes = 0;
+     int n = (this->*scan_fn)();
+     if( bad_mask || ( line_codes > 1 && ( stuck_ones == line_codes || stuck_zeros == line_codes ) )
+         || stuck_run >= stuck_run_max ) {
+       lineFault();
+     }
+     return n;
+   }
+   int measureLineN(); // generic: any muxs
+   int measureLine1(); // only one (first) channel
+   int measureLineSched(); // channels of current line of multi-rate schedule, other - NaN
+   int measureLineBatch(); // whole line in one io_xfer(), delays instead of DRDY
+   int selectScan();
+   bool isScanBatched() const { return scan_fn == &ADS1256::measureLineBatch; }
+   void setRefVolt( double rv ) { ref_volt = rv; updScale(); }
+   double getRefVolt() const { return ref_volt; }
+
+
+   const std::vector<double>& getVolts() const { return volts; }
+   const std::vector<uint8_t>& getGains() const { return gains; } // gain of every value in volts
+   bool isMultiGain() const { return multi_gain; }
+   uint64_t getGainSwitches() const { return gain_switches; }
+   bool isMultiRate() const { return multi_rate; }
+   unsigned getSchedLines() const { return sched_lines.size(); }
+   unsigned getChanDiv( unsigned i ) const { return ch_divs[i]; }
+   const std::vector<uint64_t>& getChanCounts() const { return ch_cnt; } // values measured
+   const RecStats& getRecStats() const { return rec_stats; }
+   int recover(); // 1 - chip answers and has our registers
+   void clear();
+   int get_ch_n() const { return muxs.size(); };
+   const std::vector<uint8_t>& getMuxs() const { return muxs; }
+  protected:
+   static const unsigned ch_max = 8;
+   static const AdcGainInfo gainInfo[GAIN_NUM];
+   static const AdcDrateInfo drateInfo[SPS_MAX];
+   static const uint8_t regMasks[REG_NUM]; // writable bits, for verification
+   static const unsigned wreg_max_gap = 2; // max clean regs to rewrite instead of new burst
+   double ref_volt = default_rev_v;
+   AdcGain Gain   = GAIN_1;
+   int gainval = 1;
+   uint32_t setting_dly = 400180;
+   uint32_t data_dly    = 400000;
+   std::vector<double> volts;
+   std::vector<uint8_t> muxs;
+   Drate DataRate = SPS_2d5;
+   bool need_start = true;
+   double volt_scale = default_rev_v / 0x400000; // ref_volt / gainval / 0x400000
+   using ScanFn = int (ADS1256::*)();
+   ScanFn scan_fn = &ADS1256::measureLineN;
+   uint8_t  reg_shadow[REG_NUM];
+   uint16_t reg_known = 0; // bitmask: shadow value equals chip value
+   uint16_t reg_dirty = 0; // bitmask: shadow value must be written
+   uint16_t reg_valid = 0; // bitmask: shadow was read or set once, kept by invalidateRegs()
+   bool reg_verify = false;
+   RegStats reg_stats;
+   // per channel gain: from spec (GAIN_NUM - global, GAIN_AUTO) and applied now
+   std::vector<AdcGain> ch_gains, cur_gains;
+   std::vector<uint8_t> gains;
+   bool multi_gain = false; // not one gain for all channels: generic scan, no ACAL
+   struct AutoRange {
+     uint32_t peak = 0; // max |code| at gain 1 in current window
+     unsigned cnt  = 0;
+   };
+   std::vector<AutoRange> ar;
+   uint64_t gain_switches = 0;
+   // multi-rate: channel i is measured every ch_divs[i] line, with phase from buildSched()
+   std::vector<uint16_t> ch_divs;
+   std::vector<std::vector<uint8_t>> sched_lines; // channel indexes of every line, period = lcm(divs)
+   unsigned sched_pos = 0;
+   bool multi_rate = false;
+   std::vector<uint64_t> ch_cnt;
+   static const unsigned sched_max_lines = 10000;
+   // lost values of current line: DRDY timeout or all codes 0x000000/0xFFFFFF (stuck MISO)
+   uint32_t bad_mask = 0;
+   bool sample_bad = false; // last read_code() after DRDY timeout
+   unsigned stuck_ones = 0, stuck_zeros = 0, line_codes = 0;
+   // the same all-0 or all-1 code in a row, over lines: one channel has one code per line
+   uint32_t stuck_code = 1;
+   unsigned stuck_run = 0;
+   static const unsigned stuck_run_max = 8;
+   RecStats rec_stats;
+   // batched scan: parts of one line, tx: WREG MUX, SYNC, WAKEUP, RDATA per switch
+   std::vector<IoXfer> batch;
+   std::vector<uint8_t> batch_tx, batch_rx;
+   unsigned batch_bytes = 0;
+   static const unsigned auto_win = 32;          // lines before gain may go up
+   static const uint32_t auto_up   = 0x599999;   // 70% FS: max code after gain up
+   static const uint32_t auto_down = 0x733332;   // 90% FS: go down at once
+   static const uint32_t auto_clip = 0x7FFF00;   // really clipped: go to gain 1
+
+   int32_t read_code();
+   int32_t decode_code( const uint8_t *buf ); // 24 -> 32 bit, counts stuck codes
+   double read_pure() { return read_code() * volt_scale; }
+   uint8_t adconVal( AdcGain g ) const { return ( reg_shadow[REG_ADCON] & 0xF8 ) | g; }
+   static AdcGain fitGain( uint32_t peak1 ); // max gain for peak at gain 1
+   bool autoRange( unsigned i, int32_t code ); // true - gain of channel i changed
+   int  buildSched();
+   int  buildBatch();
+   void lineFault(); // flag lost values, recover
+   void markLost( unsigned i ) { volts[i] = v_lost; bad_mask |= 1u << ( i & 31 ); }
+   void updScale() { volt_scale = ref_volt / gainval / 0x400000; }
+   void cmdSync()   {   sendByte( CMD_SYNC   );  bsp_DelayUS( time_postChan ); }
+   void cmdWakeUp() {   sendByte( CMD_WAKEUP );  bsp_DelayUS( time_wakeup   ); }
+   void cmdSyncWakeUp() { cmdSync(); cmdWakeUp();  }
+   bool regsKnown( unsigned r0, unsigned r1 ) const; // [r0,r1)
+   int  verifyRegs_noCS( uint8_t r0, uint8_t n );
+};
+
+/*
+ *  function: calculate REG_MUX value for channel or pair of channels
+ *  parameters: c1 - first channel [0:7], c2 - secons channel [0:7], if > 7 - single-ended
+ *  The return value: register valus or 0xFF if bad params ( both > 7 )
+ *********************************************************************************************************
+ */
+constexpr uint8_t ADS1256::calc_reg_mux( uint8_t c1, uint8_t c2 )
+{
+  uint8_t v = 0;
+  if( c1 >= ch_max ) {
+     v |= 0xF0; // AINCOM
+  } else {
+     v |= ( c1 << 4 ) & 0x70;
+  }
+
+  if( c2 >= ch_max ) {
+     v |= 0x0F; // AINCOM
+  } else {
+     v |= c2 & 0x07;
+  }
+
+  return v;
+}
+
+int init_hw();
+void close_hw();
+
+#endif
@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE  200113L
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "ads1256.h"
+#include "ads_out.h"
+#include "ads_evloop.h"
+#include "ads_telem.h"
+
+using namespace std;
+
+// Microbenchmarks of ads1256_da stages, running against fake bcm2835 without delays.
+// Output: one JSON object per line (stdout), to track results over time.
+
+struct BenchCnt {
+  uint64_t samples = 0; // per op
+  uint64_t lines   = 0;
+  uint64_t bytes   = 0; // total
+};
+
+static double now_s()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void report( const char *name, uint64_t iters, double t, const BenchCnt &c )
+{
+  const double ns_op = 1e9 * t / iters;
+  cout << "{\"bench\":\"" << name << "\",\"iters\":" << iters
+       << ",\"sec\":" << t << ",\"ns_per_op\":" << ns_op;
+  if( c.samples ) {
+    cout << ",\"ns_per_sample\":" << ns_op / c.samples;
+  }
+  if( c.lines ) {
+    cout << ",\"lines_per_s\":" << iters * c.lines / t;
+  }
+  if( c.bytes ) {
+    cout << ",\"bytes_per_s\":" << c.bytes / t;
+  }
+  cout << "}" << endl;
+}
+
+// f() returns number of bytes produced by one op
+template< typename F >
+static void run_bench( const char *name, uint64_t iters, BenchCnt c, F f )
+{
+  for( uint64_t i=0; i < iters / 16 + 1; ++i ) { // warm up
+    f( i );
+  }
+  double t0 = now_s();
+  for( uint64_t i=0; i < iters; ++i ) {
+    c.bytes += f( i );
+  }
+  report( name, iters, now_s() - t0, c );
+}
+
+static void show_help()
+{
+  cout << "ads1256_bench usage: \n";
+  cout << "ads1256_bench [-h] [-n iterations] [-o out_file]\n";
+}
+
+int main( int argc, char **argv )
+{
+  uint64_t N = 100000;          // -n
+  string ofn = "/dev/null";     // -o
+
+  int op;
+  while( ( op = getopt( argc, argv, "hn:o:" ) ) != -1 ) {
+    switch( op ) {
+      case 'h' : show_help(); return 0;
+      case 'n' : N   = strtoull( optarg, 0, 0 ); break;
+      case 'o' : ofn = optarg; break;
+      default:
+        cerr << "Error: unknown or bad option '" << (char)(optopt) << endl;
+        show_help();
+        return 1;
+    }
+  }
+
+  if( ! init_hw() ) {
+    cerr << "Fail to init hardware" << endl;
+    return 2;
+  }
+  bcm_fake_delay = 0;
+
+  cout << "{\"bench\":\"meta\",\"time\":" << time( nullptr )
+       << ",\"compiler\":\"" << __VERSION__ << "\",\"iters\":" << N << "}" << endl;
+
+  ADS1256 adc;
+  adc.calc_muxs_n( 8 );
+  if( adc.ReadChipID() != 3 || ! adc.syncRegs() || ! adc.CfgADC( ADS1256::GAIN_1, ADS1256::SPS_30000 ) ) {
+    cerr << "Fail to config fake ADC" << endl;
+    return 5;
+  }
+
+  BenchCnt c1; c1.samples = 1;
+  run_bench( "read_data", N, c1, [&]( uint64_t ) { adc.ReadData(); return 0; } );
+
+  ADS1256 adc_s;
+  run_bench( "calc_muxs_spec", N / 10, BenchCnt(),
+             [&]( uint64_t ) { adc_s.calc_muxs_spec( "0-1,2:5,7" ); return 0; } );
+
+  BenchCnt c8; c8.samples = 8; c8.lines = 1;
+  run_bench( "measure_line8", N / 8, c8, [&]( uint64_t ) { adc.measureLine(); return 0; } );
+
+  // transports: the same 8 channel scan by single bytes and by one batch (as spidev)
+  for( const char *tsp : { "fake", "fake:batch" } ) {
+    IoTransport *t_prev = io_tr;
+    if( ! io_select( tsp ) || ! io_tr->open() ) {
+      return 5;
+    }
+    bcm_fake_delay = 0;
+    ADS1256 adc_t;
+    adc_t.calc_muxs_n( 8 );
+    adc_t.CfgADC( ADS1256::GAIN_1, ADS1256::SPS_30000 );
+    const auto st0 = io_tr->getStats();
+    const string nm = string( "measure_line_" ) + tsp + "8";
+    run_bench( nm.c_str(), N / 8, c8, [&]( uint64_t ) { adc_t.measureLine(); return 0; } );
+    const auto &st = io_tr->getStats();
+    const double n_s = 8.0 * ( N / 8 + N / 128 + 1 ); // with warm up
+    cout << "{\"bench\":\"io\",\"transport\":\"" << tsp << "\",\"ops_per_sample\":" << ( st.ops - st0.ops ) / n_s
+         << ",\"bytes_per_sample\":" << ( st.bytes - st0.bytes ) / n_s
+         << ",\"batches_per_sample\":" << ( st.batches - st0.batches ) / n_s << "}" << endl;
+    io_tr->close();
+    io_tr = t_prev;
+  }
+
+  string obuf;
+  obuf.reserve( 256 );
+  ostringstream s_os( obuf );
+  const vector<double> &volts = adc.getVolts();
+
+  run_bench( "fmt_line8", N, c8, [&]( uint64_t i ) {
+    fmt_line( s_os, i * 1e-3, volts, i, true, 1e-6 );
+    uint64_t n = s_os.tellp();
+    s_os.str(""); s_os.clear();
+    return n;
+  } );
+
+  FdOut fout; // as -o of ads1256_da, sync: no event loop here
+  if( ! fout.open( ofn, false ) ) {
+    return 1;
+  }
+  ostream os( &fout );
+  ofstream nul( "/dev/null" );
+  auto cout_buf = cout.rdbuf( nul.rdbuf() ); // out_str() always writes to screen
+
+  double t0 = now_s();
+  BenchCnt cl; cl.lines = 1;
+  string line;
+  {
+    fmt_line( s_os, 0.0, volts, 0, true, 0.0 );
+    line = s_os.str();
+    s_os.str(""); s_os.clear();
+  }
+  for( uint64_t i=0; i<N; ++i ) {
+    s_os << line;
+    out_str( s_os, 2, os, true );
+  }
+  os.flush();
+  double t_out = now_s() - t0;
+  cl.bytes = N * line.size();
+
+  // line path of main loop (not -j): measureLine(), LineOut with -S; no scheduler and sleep
+  vector<double> v_sums( 8, 0.0 ), v_sums2( 8, 0.0 );
+  vector<uint32_t> v_cnts( 8, 0 );
+  LineOut lout { s_os, os, v_sums, v_sums2, v_cnts, 0, true, true, true };
+  BenchCnt ce; ce.samples = 8; ce.lines = 1;
+  const uint64_t NE = N / 8;
+  const uint64_t b0 = fout.getWritten() + fout.getDropped();
+  double t1 = now_s();
+  for( uint64_t i_n=0; i_n<NE; ++i_n ) {
+    adc.measureLine();
+    telem.add( Telemetry::LINES );
+    lout.put( i_n * 1e-3, adc.getVolts(), i_n, 1e-6 );
+  }
+  fout.flush();
+  double t_loop = now_s() - t1;
+  ce.bytes = fout.getWritten() + fout.getDropped() - b0;
+
+  cout.rdbuf( cout_buf );
+  report( "out_str", N, t_out, cl );
+  report( "line_path8", NE, t_loop, ce );
+
+  const auto &rs = adc.getRegStats();
+  cout << "{\"bench\":\"regs\",\"req\":" << rs.wr_req << ",\"elided\":" << rs.elided
+       << ",\"bytes_sent\":" << rs.bytes_sent << ",\"bytes_saved\":" << rs.bytesSaved() << "}" << endl;
+
+  close_hw();
+  return 0;
+}
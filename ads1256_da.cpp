@@ -8,708 +8,145 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
-#include <regex>
+#include <memory>
 
 #include <unistd.h>
 #include <getopt.h>
 #include <time.h>
-#include <signal.h>
-
-#include <bcm2835.h>
+#include <sched.h>
+
+#include "ads1256.h"
+#include "ads_out.h"
+#include "ads_capture.h"
+#include "ads_psd.h"
+#include "ads_pool.h"
+#include "ads_sched.h"
+#include "ads_telem.h"
+#include "ads_ctl.h"
+#include "ads_evloop.h"
 
 using namespace std;
 
-const double default_rev_v = 2.487226;
-
-// TODO param and function
-#define DEF_PREC setw(10) << setprecision(8)
-
-#define DO_OUT \
-    if( q_level > 1 ) { \
-      cout << '.'; \
-    } else { \
-      cout << s_os.str(); \
-    }; \
-    if( do_fout ) { \
-      os << s_os.str(); \
-    } \
-    s_os.str(""); s_os.clear();
-
-
-// CS     -----   SPICS
-// DIN    -----   MOSI
-// DOUT   -----   MISO
-// SCLK   -----   SCLK
-// DRDY   -----   ctl_IO     data  starting
-// RST    -----   ctl_IO     reset
-
-
-#define  DRDY   RPI_GPIO_P1_11  // DRDY (GPIO17, pin 11)
-#define  RST    RPI_GPIO_P1_12  // RST  (GPIO18, pin 12)
-// Many ADS1256 add-on boards use CE0 (pin 24 / GPIO8) for CS; original code used pin 15.
-#define  SPICS  RPI_GPIO_P1_24  // CS (GPIO8, pin 24)
-
-volatile int break_loop = 0;
-
-void sigint_handler( int signum );
+#define DO_OUT out_str( s_os, q_level, os, do_fout );
 
-void sigint_handler( int signum )
-{
-  ++break_loop;
-}
-
-void drop_root_cap()
-{
-  setgid(getgid());
-  setuid(getuid());
-}
 
-inline void CS_1() { bcm2835_gpio_write( SPICS, HIGH ); }
-inline void CS_0() { bcm2835_gpio_write( SPICS, LOW );  }
-
-class CS_guard {
-  public:
-   CS_guard()  { bcm2835_gpio_write( SPICS, LOW  ); };
-   ~CS_guard() { bcm2835_gpio_write( SPICS, HIGH ); };
+struct AdcCfg {
+  std::string spec; // -C, or
+  int n_ch;         // -c
+  int gain, drate;
 };
 
-inline bool DRDY_IS_LOW() { return bcm2835_gpio_lev( DRDY ) == 0; };
-
-inline void RST_1() {  bcm2835_gpio_write( RST, HIGH ); }
-inline void RST_0() {  bcm2835_gpio_write( RST, LOW );  }
-
-inline void  bsp_DelayUS( uint64_t micros )
+string cfg_str( const AdcCfg &c )
 {
-#ifdef __arm__
-  bcm2835_delayMicroseconds( micros );
-#else
-  usleep( micros );
-#endif
+  return ( c.spec.empty() ? "c= " + to_string( c.n_ch ) : "C= " + c.spec )
+    + " g= " + to_string( c.gain ) + " D= " + to_string( c.drate );
 }
 
-class ADS1256 {
-  public:
-   enum AdcTimes {
-     time_send = 2,         // really 4 tau, 5.2e-7
-     time_postcfg = 50,     //
-     time_delayData  = 10,  //
-     time_postChan = 5,     //
-     time_wakeup = 25       //
-   };
-   enum AdcGain {
-     GAIN_1      = 0,
-     GAIN_2      = 1,
-     GAIN_4      = 2,
-     GAIN_8      = 3,
-     GAIN_16     = 4,
-     GAIN_32     = 5,
-     GAIN_64     = 6,
-     GAIN_NUM    // 7
-   };
-   struct AdcGainInfo {
-     AdcGain idx;
-     uint8_t val;
-   };
-   enum Drate {
-     SPS_30000 = 0,
-     SPS_15000,
-     SPS_7500,
-     SPS_3750,
-     SPS_2000,
-     SPS_1000,
-     SPS_500,
-     SPS_100,
-     SPS_60,
-     SPS_50,
-     SPS_30,
-     SPS_25,
-     SPS_15,
-     SPS_10,
-     SPS_5,
-     SPS_2d5,
-     SPS_MAX
-   };
-   struct AdcDrateInfo {
-     Drate    idx;
-     uint16_t val;
-     uint8_t  regval;
-     uint32_t t18; // setting time in us, table 13
-     uint32_t t19; // setting time in us, table 13
-   };
-
-   enum RegNum { //* Register definitions Table 23. Register Map --- ADS1256 datasheet Page 30
-                 //  Register address, followed by reset the default values
-     REG_STATUS =  0, // x1H
-     REG_MUX    =  1, // 01H
-     REG_ADCON  =  2, // 20H
-     REG_DRATE  =  3, // F0H
-     REG_IO     =  4, // E0H
-     REG_OFC0   =  5, // xxH
-     REG_OFC1   =  6, // xxH
-     REG_OFC2   =  7, // xxH
-     REG_FSC0   =  8, // xxH
-     REG_FSC1   =  9, // xxH
-     REG_FSC2   = 10, // xxH
-   };
-
-   //* Command definitions TTable 24. Command Definitions --- ADS1256 datasheet Page 34
-   enum Commands  {
-     CMD_WAKEUP  = 0x00, //* Completes SYNC and Exits Standby Mode 0000  0000 (00h)
-     CMD_RDATA   = 0x01, //* Read Data 0000  0001 (01h)
-     CMD_RDATAC  = 0x03, //* Read Data Continuously 0000   0011 (03h)
-     CMD_SDATAC  = 0x0F, //* Stop Read Data Continuously 0000   1111 (0Fh)
-     CMD_RREG    = 0x10, //* Read from REG rrr 0001 rrrr (1xh)
-     CMD_WREG    = 0x50, //* Write to REG rrr 0101 rrrr (5xh)
-     CMD_SELFCAL = 0xF0, //* Offset and Gain Self-Calibration 1111    0000 (F0h)
-     CMD_SELFOCAL= 0xF1, //* Offset Self-Calibration 1111    0001 (F1h)
-     CMD_SELFGCAL= 0xF2, //* Gain Self-Calibration 1111    0010 (F2h)
-     CMD_SYSOCAL = 0xF3, //* System Offset Calibration 1111   0011 (F3h)
-     CMD_SYSGCAL = 0xF4, //* System Gain Calibration 1111    0100 (F4h)
-     CMD_SYNC    = 0xFC, //* Synchronize the A/D Conversion 1111   1100 (FCh)
-     CMD_STANDBY = 0xFD, //* Begin Standby Mode 1111   1101 (FDh)
-     CMD_RESET   = 0xFE, //* Reset to Power-Up Values 1111   1110 (FEh)
-   };
-
-   ADS1256();
-   void sendByte( uint8_t data );
-   void sendBytes( uint8_t d0, uint8_t d1 );
-   void sendBytes( uint8_t d0, uint8_t d1, uint8_t d2 );
-   void sendBytes( const uint8_t *data, unsigned n );
-   static AdcGain findGain( int g );
-   static Drate   findDrate( int sps );
-   static uint8_t calc_reg_mux( uint8_t c1, uint8_t c2 );
-   int calc_muxs_n( int n );
-   int calc_muxs_spec( const string &spec );
-   int  CfgADC( AdcGain gain, Drate drate );
-   void DelayDATA() { bsp_DelayUS( time_delayData ); } // The minimum time delay 6.5us
-   void WriteReg( uint8_t RegID, uint8_t RegValue );
-   void WriteReg_noCS( uint8_t RegID, uint8_t RegValue );
-   uint8_t ReadReg( uint8_t RegID );
-   void WriteCmd( uint8_t cmd );
-   uint8_t ReadChipID();
-   int  WaitDRDY( uint32_t us = 1000 );
-   double ReadData();
-   double MSW_ReadData( uint8_t m ); // wait, set MUX, sync, wakeup, real old data
-   int measureLine();
-   int measureLine1(); // only one (first) channel
-   void setRefVolt( double rv ) { ref_volt = rv; }
-   double getRefVolt() const { return ref_volt; }
-
-
-   const vector<double>& getVolts() const { return volts; }
-   void clear();
-   int get_ch_n() const { return muxs.size(); };
-   const vector<uint8_t>& getMuxs() const { return muxs; }
-  protected:
-   static const unsigned ch_max = 8;
-   static const AdcGainInfo gainInfo[GAIN_NUM];
-   static const AdcDrateInfo drateInfo[SPS_MAX];
-   double ref_volt = default_rev_v;
-   AdcGain Gain   = GAIN_1;
-   int gainval = 1;
-   uint32_t setting_dly = 400180;
-   uint32_t data_dly    = 400000;
-   vector<double> volts;
-   vector<uint8_t> muxs;
-   Drate DataRate = SPS_2d5;
-   bool need_start = true;
-
-   uint8_t recvByte() {  return bcm2835_spi_transfer( 0xFF ); }
-   void  recv3Byte( uint8_t *d ) {  d[0] = recvByte(); d[1] = recvByte(); d[2] = recvByte();  }
-   double read_pure();
-   void cmdSync()   {   sendByte( CMD_SYNC   );  bsp_DelayUS( time_postChan ); }
-   void cmdWakeUp() {   sendByte( CMD_WAKEUP );  bsp_DelayUS( time_wakeup   ); }
-   void cmdSyncWakeUp() { cmdSync(); cmdWakeUp();  }
-};
-
-const ADS1256::AdcGainInfo ADS1256::gainInfo[ADS1256::GAIN_NUM] = {
-  { GAIN_1,   1 },
-  { GAIN_2,   2 },
-  { GAIN_4,   4 },
-  { GAIN_8,   8 },
-  { GAIN_16, 16 },
-  { GAIN_32, 32 },
-  { GAIN_64, 64 }
-};
-
-const ADS1256::AdcDrateInfo ADS1256::drateInfo[ADS1256::SPS_MAX] = {
-//   idx         val  regval   t18    t19
-  { SPS_30000, 30000, 0xF0,    210,    229 },
-  { SPS_15000, 15000, 0xE0,    250,    262 },
-  { SPS_7500,   7500, 0xD0,    310,    329 },
-  { SPS_3750,   3750, 0xC0,    440,    462 },
-  { SPS_2000,   2000, 0xB0,    680,    695 },
-  { SPS_1000,   1000, 0xA1,   1180,   1195 },
-  { SPS_500,     500, 0x92,   2180,   2193 },
-  { SPS_100,     100, 0x82,  10180,  10204 },
-  { SPS_60,       60, 0x72,  16840,  16949 },
-  { SPS_50,       50, 0x63,  20180,  20000 },
-  { SPS_30,       30, 0x53,  33510,  33333 },
-  { SPS_25,       25, 0x43,  40180,  40000 },
-  { SPS_15,       15, 0x33,  66840,  66667 },
-  { SPS_10,       10, 0x23, 100180, 100000 },
-  { SPS_5,         5, 0x13, 200180, 200000 },
-  { SPS_2d5,       2, 0x03, 400180, 400000 } // really 2.5
-};
-
-
-ADS1256::ADS1256()
-{
-  volts.reserve( 32 );
-  volts.assign( 32, 0.0 );
-}
-
-
-ADS1256::AdcGain ADS1256::findGain( int g )
-{
-  for( auto v : ADS1256::gainInfo ) {
-    if( v.val == g ) {
-      return v.idx;
-    }
-  }
-  return GAIN_NUM;
-}
-
-ADS1256::Drate  ADS1256::findDrate( int sps )
-{
-  for( auto v : drateInfo ) {
-    if( v.val == sps ) {
-      return v.idx;
-    }
-  }
-  return SPS_MAX;
-}
-
-
 /*
- *  function: calculate REG_MUX value for channel or pair of channels
- *  parameters: c1 - first channel [0:7], c2 - secons channel [0:7], if > 7 - single-ended
- *  The return value: register valus or 0xFF if bad params ( both > 7 )
- *********************************************************************************************************
+ *  name: reconf_adc
+ *  function: apply new channels, gain and data rate between two lines, without
+ *            hardware reset: only changed registers are written (register shadow).
+ *            On error old configuration is restored.
+ *  The return value: 1 - ok, 0 - error, err - reason
  */
-uint8_t ADS1256::calc_reg_mux( uint8_t c1, uint8_t c2 )
-{
-  uint8_t v = 0;
-  if( c1 >= ch_max ) {
-     v |= 0xF0; // AINCOM
-  } else {
-     v |= ( c1 << 4 ) & 0x70;
-  }
-
-  if( c2 >= ch_max ) {
-     v |= 0x0F; // AINCOM
-  } else {
-     v |= c2 & 0x07;
-  }
-
-  return v;
-}
-
-int ADS1256::calc_muxs_n( int n )
-{
-  if( n > (int)ch_max ) {
-    n = ch_max;
-  }
-  muxs.clear();
-  for( int i=0; i<n; ++i ) {
-    uint8_t m = calc_reg_mux( (uint8_t)(i), 0xFF );
-    if( m != 0xFF ) {
-      muxs.emplace_back( m );
-    }
-  }
-  clear();
-  return muxs.size();
-}
-
-int ADS1256::calc_muxs_spec( const string &spec )
-{
-  muxs.clear();
-  if( spec.empty() ) {
-    return 0;
-  }
-  regex decuns( "^\\d+$" );
-  regex decdiff( "^(\\d+)-(\\d+)$" );
-  regex decrange( "^(\\d+):(\\d+)$" );
-
-  bool need_next = true;
-  string badstr;
-  for( auto c = spec.cbegin(); need_next;  ) {
-    auto f = find( c, spec.cend(), ',' );
-    if( f == spec.cend() ) {
-      need_next = false;
-    }
-    string t1 ( c, f );
-    smatch sm;
-    // cerr << t1 << endl;
-    if( regex_search( t1, decuns ) ) {
-      int ch1 = stoi( t1, nullptr, 0 );
-      // cout << " ch1= " << ch1;
-      uint8_t m = calc_reg_mux( (uint8_t)(ch1), 0xFF );
-      if( m != 0xFF ) {
-        muxs.emplace_back( m );
-      } else {
-        badstr = t1; break;
-      };
-    } else if( regex_search( t1, sm, decdiff ) ) {
-      int ch1 = stoi( sm[1], nullptr, 0 );
-      int ch2 = stoi( sm[2], nullptr, 0 );
-      // cout << " ch1= " << ch1 << " ch2= " << ch2;
-      uint8_t m = calc_reg_mux( (uint8_t)(ch1), (uint8_t)(ch2) );
-      if( m != 0xFF ) {
-        muxs.emplace_back( m );
-      } else {
-        badstr = t1; break;
-      };
-    } else if( regex_search( t1, sm, decrange ) ) {
-      int ch1 = stoi( sm[1], nullptr, 0 );
-      int ch2 = stoi( sm[2], nullptr, 0 );
-      // cout << " ch1= " << ch1 << " ch2= " << ch2;
-      for( int c = ch1; c <= ch2 && badstr.empty(); ++c ) {
-        uint8_t m = calc_reg_mux( (uint8_t)(c), 0xFF );
-        if( m != 0xFF ) {
-          muxs.emplace_back( m );
-        } else {
-          badstr = t1; break;
-        };
-      }
-    } else {
-      badstr = t1; break;
-    }
-    ++f; c = f;
-    // cerr << endl;
-  }
-
-  if( ! badstr.empty() ) {
-      cerr << "Error: bad channel spec string \"" << badstr << "\"" << endl;
-      muxs.clear();
-      return 0;
-  }
-
-  return muxs.size();
-}
-
-
-int ADS1256::measureLine()
-{
-  int n = 0;
-  int mc = muxs.size();
-  clear();
-  if( mc < 1 ) {
-    return 0;
-  }
-  if( mc == 1 ) {
-    return measureLine1();
-  }
-
-  CS_guard csg;
-
-  WriteReg_noCS( REG_MUX, muxs[0] );
-  bsp_DelayUS( time_postChan );
-
-  cmdSyncWakeUp();
-  WaitDRDY( data_dly );
-
-  for( int i=0; i<mc; ++i ) {
-    int j = i+1;
-    if( j >= mc ) { j  = 0; }
-    volts[i] = MSW_ReadData( muxs[j] );
-    ++n;
-  }
-
-  return n;
-}
-
-int ADS1256::measureLine1()
+int reconf_adc( ADS1256 &adc, AdcCfg &cur, const CtlServer::Request &r, string &err )
 {
-  if( muxs.size() < 1 ) {
+  AdcCfg nc = cur;
+  if( ! r.spec.empty() ) {
+    nc.spec = r.spec; nc.n_ch = -1;
+  } else if( r.n_ch > 0 ) {
+    nc.n_ch = r.n_ch; nc.spec.clear();
+  }
+  if( r.gain > 0 ) {
+    nc.gain = r.gain;
+  }
+  if( r.drate > 0 ) {
+    nc.drate = r.drate;
+  }
+  auto gain_idx  = ADS1256::findGain( nc.gain );
+  auto drate_idx = ADS1256::findDrate( nc.drate );
+  if( gain_idx >= ADS1256::GAIN_NUM || drate_idx >= ADS1256::SPS_MAX ) {
+    err = "bad gain or drate";
     return 0;
   }
 
-  if( need_start ) {
-    WriteReg( REG_MUX, muxs[0] );
-    bsp_DelayUS( time_postChan );
-    cmdSyncWakeUp();
-    need_start = false;
-  }
-
-  WaitDRDY( data_dly );
-  volts[0] = ReadData();
-  return 1;
-}
-
-double ADS1256::ReadData()
-{
-  CS_guard csg;
-
-  return read_pure();
-}
-
-double ADS1256::MSW_ReadData( uint8_t m )
-{
-  WaitDRDY( data_dly );
-
-  bsp_DelayUS( time_postChan );
-
-  WriteReg_noCS( REG_MUX, m );
-  bsp_DelayUS( time_postChan );
-  cmdSyncWakeUp();
-
-  return read_pure();
-}
-
-double ADS1256::read_pure()
-{
-  sendByte( CMD_RDATA );
-
-  DelayDATA();
-
-  uint8_t buf[3];
-  recv3Byte( buf );
-
-  uint32_t
-  read  =  ( (uint32_t)buf[0] << 16 ) & 0x00FF0000;
-  read |=  ( (uint32_t)buf[1] <<  8 );
-  read |=  buf[2];
-
-  if( read & 0x800000 ) { // 24->32 bit signed
-    read |= 0xFF000000;
-  }
-
-  return (double)((int32_t)(read))  * ref_volt / gainval / 0x400000;
-}
-
-
-
-void ADS1256::sendByte( uint8_t d0 )
-{
-  bsp_DelayUS( time_send );
-  bcm2835_spi_transfer( d0 );
-}
-
-void ADS1256::sendBytes( uint8_t d0, uint8_t d1 )
-{
-  bsp_DelayUS( time_send );
-  bcm2835_spi_transfer( d0 );
-  bcm2835_spi_transfer( d1 );
-}
-
-void ADS1256::sendBytes( uint8_t d0, uint8_t d1, uint8_t d2 )
-{
-  bsp_DelayUS( time_send );
-  bcm2835_spi_transfer( d0 );
-  bcm2835_spi_transfer( d1 );
-  bcm2835_spi_transfer( d2 );
-}
-
-void ADS1256::sendBytes( const uint8_t *data, unsigned n )
-{
-  bsp_DelayUS( time_send );
-  for( unsigned i=0; i<n; ++i ) {
-    bcm2835_spi_transfer( data[i] );
-  }
-}
-
-/*
- *********************************************************************************************************
- *  name: ADS1256::CfgADC
- *  function: The configuration parameters of ADC, gain and data rate
- *  parameter: gain:gain 1-64
- *                      drate:  data  rate
- *  The return value: 1 - ok, 0 - error
- *********************************************************************************************************
- */
-int  ADS1256::CfgADC( AdcGain gain, Drate drate )
-{
-  if( gain >= GAIN_NUM || drate >= SPS_MAX ) {
+  auto set_muxs = []( ADS1256 &a, const AdcCfg &c ) {
+    return c.spec.empty() ? a.calc_muxs_n( c.n_ch ) : a.calc_muxs_spec( c.spec );
+  };
+  ADS1256 chk; // no hardware: bad spec must not touch scan function and schedule of adc
+  if( set_muxs( chk, nc ) < 1 ) {
+    err = "bad channels";
     return 0;
   }
-
-  Gain = gain;
-  gainval = gainInfo[gain].val;
-  DataRate = drate;
-  setting_dly = drateInfo[DataRate].t18;
-  if( drate == SPS_2d5 ) {
-    data_dly = 400000;
-  } else {
-    data_dly = 1000000 / drateInfo[drate].val;
-  }
-  cerr << "# setting_dly= " << setting_dly << " data_dly= " << data_dly << endl;
-
-  if( ! WaitDRDY( setting_dly ) ) {
+  set_muxs( adc, nc );
+  if( ! adc.CfgADC( gain_idx, drate_idx ) ) {
+    err = "fail to config ADC";
+    set_muxs( adc, cur ); // full sequence again: scan function, schedule
+    adc.CfgADC( ADS1256::findGain( cur.gain ), ADS1256::findDrate( cur.drate ) );
     return 0;
   }
-
-  uint8_t buf[4];    /* Storage ads1256 register configuration parameters */
-
-  //       BitOrder     ACAL      Buffer
-  buf[0] = (0 << 3) | (1 << 2) | (1 << 1);   // STATUS. TODO: buffer ctl
-  buf[1] = muxs[0];                          // MUX
-  //         CLKxx     SDCSx
-  buf[2] = (0 << 5) | (0 << 3) |  gain;      // ADCON
-  buf[3] = drateInfo[drate].regval;          // DRATE
-
-  CS_guard csg;
-
-  sendBytes( CMD_WREG | 0, 0x03 );  // Write command register, send the register address, write
-  sendBytes( buf, 4 );              // 4 low regs
-
-  bsp_DelayUS( time_postcfg );
+  cur = nc;
   return 1;
 }
 
-
-/*
- *********************************************************************************************************
- *  name: ADS1256::WriteReg
- *  function: Write the corresponding register
- *  parameter: RegID: register  ID
- *       RegValue: register Value
- *  The return value: NULL
- *********************************************************************************************************
- */
-void ADS1256::WriteReg( uint8_t RegID, uint8_t RegValue )
-{
-  CS_guard csg;
-
-  sendBytes( CMD_WREG | RegID, 0, RegValue );  //* Write command register, num, value
-}
-
-void ADS1256::WriteReg_noCS( uint8_t RegID, uint8_t RegValue )
-{
-  sendBytes( CMD_WREG | RegID, 0, RegValue );  //* Write command register, num, value
-}
-
-/*
- *********************************************************************************************************
- *  name: ADS1256::ReadReg
- *  function: Read  the corresponding register
- *  parameter: RegID: register  ID
- *  The return value: read register value
- *********************************************************************************************************
- */
-uint8_t ADS1256::ReadReg( uint8_t RegID )
-{
-  CS_guard csg;
-
-  sendBytes( CMD_RREG | RegID, 0 );  // Write command register
-
-  DelayDATA();
-
-  return recvByte();
-}
-
-/*
- *********************************************************************************************************
- *  name: ADS1256::WriteCmd
- *  function: Sending a single byte order
- *  parameter: cmd : command
- *********************************************************************************************************
- */
-void ADS1256::WriteCmd( uint8_t cmd )
-{
-  CS_guard csg;
-  sendByte( cmd );
-}
-
-uint8_t ADS1256::ReadChipID()
+// current statistics on SIGHUP: to stderr, main output goes on
+void dump_stats( ostream &s, uint32_t n, const vector<double> &sums, const vector<double> &sums2,
+                 const vector<uint32_t> &cnts )
 {
-  if( ! WaitDRDY( setting_dly ) ) {
-    return 0;
+  s << "# stats: n= " << n << " avg:";
+  for( unsigned i=0; i<sums.size(); ++i ) {
+    s << ' ' << sums[i] / cnts[i];
   }
-  int8_t id = ReadReg( REG_STATUS );
-  return ( id >> 4 );
-}
-
-
-/*
- *  name: ADS1256::WaitDRDY
- *  function: wait for data ready signal
- *  The return value:  0 - timeout, 1 = ok
- *********************************************************************************************************
- */
-int ADS1256::WaitDRDY( uint32_t us )
-{
-  for( uint32_t i = 0; i < us; ++i ) {
-    if( DRDY_IS_LOW() ) {
-      return 1;
-    }
-    usleep( 1 );
+  s << " sd:";
+  for( unsigned i=0; i<sums.size(); ++i ) {
+    const uint32_t c = cnts[i];
+    s << ' ' << sqrt( sums2[i] * c - sums[i] * sums[i] ) / c;
   }
-  cerr << "WaitDRDY() Time Out ..." << endl;
-  return 0;
+  s << endl;
 }
 
-
-void ADS1256::clear()
+// values, which are not updated by hot path itself
+void publish_telem( const PeriodicSched &sched, const WelchPSD *psd, const ADS1256 &adc )
 {
-  volts.assign( muxs.size(), 0.0 );
+  telem.setCnt( Telemetry::SCHED_MISSED,  sched.getMissed() );
+  telem.setCnt( Telemetry::SCHED_SKIPPED, sched.getSkipped() );
+  const LatHist &h = sched.getHist();
+  if( h.getN() > 0 ) {
+    telem.set( Telemetry::LATE_P50,  h.percentile( 0.5 )   * 1e-9 );
+    telem.set( Telemetry::LATE_P99,  h.percentile( 0.99 )  * 1e-9 );
+    telem.set( Telemetry::LATE_P999, h.percentile( 0.999 ) * 1e-9 );
+    telem.set( Telemetry::LATE_SUM,  h.getSum() * 1e-9 );
+    telem.set( Telemetry::LATE_COUNT, h.getN() );
+    telem.set( Telemetry::LATE_MAX,  h.getMax() * 1e-9 );
+  }
+  if( psd ) {
+    telem.set( Telemetry::PSD_QUEUE, psd->queueDepth() );
+    telem.setCnt( Telemetry::PSD_DROPPED, psd->getDropped() );
+  }
+  telem.setCnt( Telemetry::GAIN_SWITCHES, adc.getGainSwitches() );
 }
 
-/*
- *********************************************************************************************************
- *  name: Write_DAC8552
- *  function:  DAC send data
- *  parameter: channel : output channel number
- *         data : output DAC value
- *  The return value:  NULL
- *********************************************************************************************************
- */
-// void Write_DAC8552( uint8_t channel, uint16_t Data )
-// {
-//   // uint8_t i;
-//   CS_1() ;
-//   CS_0() ;
-//   bcm2835_spi_transfer( channel);
-//   bcm2835_spi_transfer( Data>>8 );
-//   bcm2835_spi_transfer( Data&0xff );
-//   CS_1() ;
-// }
-
-/*
- *********************************************************************************************************
- *  name: Voltage_Convert
- *  function:  Voltage value conversion function
- *  parameter: Vref : The reference voltage 3.3V or 5V
- *         voltage : output DAC value
- *  The return value:  NULL
- *********************************************************************************************************
- */
-// uint16_t Voltage_Convert( float Vref, float voltage )
-// {
-//   return (uint16_t)( 65536 * voltage / Vref );
-// }
-
-int init_hw()
+void drop_root_cap()
 {
-  if( !bcm2835_init() ) {
-    return 0;
-  }
-  if( ! bcm2835_spi_begin() )  {
-    return 0;
-  }
-  // ADS1256 requires MSB first
-  bcm2835_spi_setBitOrder( BCM2835_SPI_BIT_ORDER_MSBFIRST );
-  bcm2835_spi_setDataMode( BCM2835_SPI_MODE1 );                  // The default = MODE1
-  bcm2835_spi_setClockDivider( BCM2835_SPI_CLOCK_DIVIDER_1024 ); // The default = 1024
-  bcm2835_gpio_fsel( SPICS, BCM2835_GPIO_FSEL_OUTP );
-  bcm2835_gpio_write( SPICS, HIGH );
-  bcm2835_gpio_fsel( DRDY, BCM2835_GPIO_FSEL_INPT );
-  bcm2835_gpio_set_pud( DRDY, BCM2835_GPIO_PUD_UP );
-  bcm2835_gpio_fsel( RST, BCM2835_GPIO_FSEL_OUTP );
-  // Hardware reset pulse
-  bcm2835_gpio_write( RST, LOW );
-  bcm2835_delayMicroseconds( 10000 );
-  bcm2835_gpio_write( RST, HIGH );
-  bcm2835_delayMicroseconds( 5000 );
-  return 1;
+  setgid(getgid());
+  setuid(getuid());
 }
 
 void show_help()
 {
   cout << "ads1256_da usage: \n";
-  cout << "ads1256_da [-h] [-d] [-q level] [-t t_dly,us ] [ -c channels ] \n";
-  cout << "   or [ -C c1-c2,c3 ] [ -g gain ] [ -D drate ] [ -n iterations ]\n";
-  cout << "   [ -r ref_volt ] [ -o file ] [-S] [-T]\n";
+  cout << "ads1256_da [-h] [-d] [-q level] [-t t_dly,ms (0.25 or 250us, 0 - no wait) ] [ -c channels ] \n";
+  cout << "   or [ -C c1-c2,c3@gain,c4@auto,c5:c7/div ] [ -g gain ] [ -D drate ] [ -n iterations ]\n";
+  cout << "   [ -r ref_volt ] [ -o file ] [-S] [-T] [-V] [-G (applied gains)]\n";
+  cout << "   [ -R trace_file (record, SIGUSR1 - dump) ] [ -Y trace_file (replay) ]\n";
+  cout << "   [ -I capture_file (input instead of ADC) [-W (original rate)] ]\n";
+  cout << "   [ -F nfft (Welch PSD) [ -f psd_file ] [ -b f1:f2 (band, Hz) ] ]\n";
+  cout << "   [ -j workers (parallel statistics and formatting) ]\n";
+  cout << "   [ -p catchup|skip|stretch (policy for missed periods) ]\n";
+  cout << "   [ -M metrics_file (Prometheus text, every 1 s) ] [ -U metrics_socket ]\n";
+  cout << "   [ -Z control_socket (daemon: set C=spec|c=n g=gain D=drate, get, stop) ]\n";
+  cout << "   [ -B bcm2835|spidev[:dev[:hz[:gpiochip]]]|fake[:batch] (transport) ]\n";
+  cout << "     spidev: experimental, not tested on hardware; one ioctl per command, CS by spi core\n";
 }
 
 
@@ -719,7 +156,8 @@ int main( int argc, char **argv )
 {
   int debug = 0;             // -d
   int q_level = 0;           // -q
-  uint32_t t_dly = 1000;     // in ms, -t
+  uint64_t t_dly_ns = 1000000000; // -t, in ms, may be fractional or "250us"
+  auto sched_pol = PeriodicSched::POL_CATCHUP; // -p
   uint32_t N = 1000;         // -n
   int   n_ch = -1;           // -c
   string   ch_specs;         // -C
@@ -732,15 +170,40 @@ int main( int argc, char **argv )
   bool do_fout = false;
   bool do_probe = false;     // -P quick probe mode
   bool do_diag = false;      // -X diagnostics (print pin states, raw status)
+  bool do_verify = false;    // -V verify register writes
+  bool do_gains = false;     // -G output applied gain of every value
+  string trace_fn;           // -R record SPI/GPIO trace
+  string replay_fn;          // -Y replay trace instead of hardware
+  string cap_fn;             // -I input from capture file instead of ADC
+  bool cap_pace = false;     // -W feed capture at original rate
+  bool N_set = false;
+  unsigned psd_nfft = 0;     // -F Welch PSD segment length, 0 - off
+  string psd_fn;             // -f PSD file, rewritten periodically
+  double psd_f1 = 0, psd_f2 = -1; // -b band for noise density
+  unsigned n_workers = 0;    // -j post-processing threads, 0 - in loop
+  string telem_fn;           // -M Prometheus text file
+  string telem_sock;         // -U Unix socket for metrics query
+  string ctl_sock;           // -Z daemon mode: control socket
+  string io_spec;            // -B transport: bcm2835, spidev[:dev[:hz[:gpiochip]]], fake[:batch]
 
   int op; // TODO: -q 0 1 2, -B - buffer
-  while( ( op = getopt( argc, argv, "hdq:t:n:g:c:C:D:r:o:STPX" ) ) != -1 ) {
+  while( ( op = getopt( argc, argv, "hdq:t:n:g:c:C:D:r:o:STPXVGR:Y:I:WF:f:b:j:p:M:U:Z:B:" ) ) != -1 ) {
     switch( op ) {
       case 'h' : show_help(); return 0;
       case 'd' : ++debug; break;
       case 'q' : q_level = strtol( optarg, 0, 0 ); break;
-      case 't' : t_dly = strtol( optarg, 0, 0 ); break;
-      case 'n' : N     = strtol( optarg, 0, 0 ); break;
+      case 't' : if( ! PeriodicSched::parsePeriod( optarg, t_dly_ns ) ) {
+                   cerr << "Error: bad period \"" << optarg << "\"" << endl;
+                   return 1;
+                 }
+                 break;
+      case 'p' : sched_pol = PeriodicSched::findPolicy( optarg );
+                 if( sched_pol >= PeriodicSched::POL_NUM ) {
+                   cerr << "Error: bad policy \"" << optarg << "\", must be catchup, skip or stretch" << endl;
+                   return 1;
+                 }
+                 break;
+      case 'n' : N     = strtol( optarg, 0, 0 ); N_set = true; break;
       case 'c' : n_ch  = strtol( optarg, 0, 0 ); break;
       case 'g' : gain  = strtol( optarg, 0, 0 ); break;
       case 'D' : drate  = strtol( optarg, 0, 0 ); break;
@@ -751,6 +214,24 @@ int main( int argc, char **argv )
       case 'T' : do_dtime  = false; break;
   case 'P' : do_probe  = true; break;
   case 'X' : do_diag   = true; break;
+      case 'V' : do_verify = true; break;
+      case 'G' : do_gains  = true; break;
+      case 'R' : trace_fn  = optarg; break;
+      case 'Y' : replay_fn = optarg; break;
+      case 'I' : cap_fn    = optarg; break;
+      case 'W' : cap_pace  = true; break;
+      case 'F' : psd_nfft  = strtoul( optarg, 0, 0 ); break;
+      case 'j' : n_workers = strtoul( optarg, 0, 0 ); break;
+      case 'f' : psd_fn    = optarg; break;
+      case 'M' : telem_fn  = optarg; break;
+      case 'U' : telem_sock = optarg; break;
+      case 'Z' : ctl_sock  = optarg; break;
+      case 'B' : io_spec   = optarg; break;
+      case 'b' : if( sscanf( optarg, "%lf:%lf", &psd_f1, &psd_f2 ) != 2 || ! ( psd_f1 >= 0 && psd_f1 < psd_f2 ) ) {
+                   cerr << "Error: bad band \"" << optarg << "\", must be f1:f2, 0 <= f1 < f2" << endl;
+                   return 1;
+                 }
+                 break;
       default:
         cerr << "Error: unknown or bad option '" << (char)(optopt) << endl;
         show_help();
@@ -758,8 +239,13 @@ int main( int argc, char **argv )
     }
   }
 
+  if( ! io_spec.empty() && ! io_select( io_spec ) ) {
+    return 1;
+  }
+
   ADS1256 adc;
   adc.setRefVolt( ref_volt );
+  adc.setVerify( do_verify );
 
   if( n_ch > 0 ) {
     if( ! ch_specs.empty() ) {
@@ -795,15 +281,32 @@ int main( int argc, char **argv )
 
   // TODO: check drate with t_dly
 
-  uint32_t t_add_sec = t_dly / 1000;
-  uint32_t t_add_ns = ( t_dly % 1000 ) * 1000000;
-
   int ch_n = adc.get_ch_n();
+  AdcCfg cur_cfg { ch_specs, n_ch, gain, drate }; // changed by control socket
+
+  if( ! ctl_sock.empty() ) {
+    if( ! cap_fn.empty() || ! replay_fn.empty() || psd_nfft > 0 ) {
+      cerr << "Error: -Z can not be used with -I, -Y or -F" << endl;
+      return 1;
+    }
+    if( ! N_set ) {
+      N = UINT32_MAX;
+    }
+  }
+
+  CaptureReader cap;
+  const bool do_cap = ! cap_fn.empty();
+  if( do_cap ) {
+    ch_n = cap.open( cap_fn );
+    if( ! N_set ) {
+      N = UINT32_MAX;
+    }
+  }
 
   if( debug > 0 ) {
-    cerr << "N= " << N << " t_dly= " << t_dly << " ch_n= " << ch_n
+    cerr << "N= " << N << " t_dly_ns= " << t_dly_ns << " ch_n= " << ch_n
          << " gain= " << gain << " gain_idx= " << (int)(gain_idx) <<" ref_volt= " << ref_volt
-         << " t_add_sec= " << t_add_sec << " t_add_ns= " << t_add_ns << endl;
+         << " policy= " << PeriodicSched::policyName( sched_pol ) << endl;
   }
   if( debug > 1 ) {
     auto m = adc.getMuxs();
@@ -820,115 +323,250 @@ int main( int argc, char **argv )
   }
 
   vector<double> v_sums( ch_n, 0.0 ), v_sums2( ch_n, 0.0 );
+  vector<uint32_t> v_cnts( ch_n, 0 ); // '-' (not measured) values are not counted
+  uint32_t i_n_stat = 0; // first line of statistics: last reconfiguration
 
-  if( ! init_hw() ) {
-    cerr << "Fail to init hardware" << endl;
-    return 2;
+  unique_ptr<WelchPSD> psd;
+  if( psd_nfft > 0 ) {
+    if( psd_nfft < 8 || ( psd_nfft & ( psd_nfft - 1 ) ) ) {
+      cerr << "Error: PSD nfft " << psd_nfft << " must be power of 2, >= 8" << endl;
+      return 1;
+    }
+    if( t_dly_ns == 0 ) {
+      cerr << "Error: -F needs -t > 0: sample rate is 1000/t_dly" << endl;
+      return 1;
+    }
+    psd.reset( new WelchPSD( psd_nfft, ch_n, 1e9 / t_dly_ns ) );
+    if( psd_f2 > 0 && ! psd->setBand( psd_f1, psd_f2 ) ) {
+      cerr << "Error: band " << psd_f1 << ':' << psd_f2 << " Hz is not inside [0, " << psd->getFs() / 2 << "] Hz" << endl;
+      return 1;
+    }
+    if( ! psd_fn.empty() ) {
+      psd->setOutFile( psd_fn );
+    }
   }
 
-  if( do_diag ) {
-    cerr << "# DIAG: DRDY level=" << bcm2835_gpio_lev( DRDY )
-         << " CS level=" << bcm2835_gpio_lev( SPICS )
-         << " RST level=" << bcm2835_gpio_lev( RST ) << endl;
-  }
+  unsigned trace_dumps = 0;
+  if( ! do_cap ) {
+    if( ! replay_fn.empty() ) {
+      if( ! io_trace.startReplay( replay_fn ) ) {
+        return 1;
+      }
+    } else if( ! trace_fn.empty() ) {
+      io_trace.startRecord();
+    }
+
+    if( ! init_hw() ) {
+      cerr << "Fail to init hardware" << endl;
+      return 2;
+    }
 
-  uint8_t id = adc.ReadChipID();
-  if( id != 3 )  {
-    cerr << "Bad chip ID " << (int)id << " (expected 3)." << endl;
     if( do_diag ) {
-      cerr << "# Hint: Check wiring: DRDY->pin11(GPIO17), RST->pin12(GPIO18), CS->pin15(GPIO22), SCLK->pin23(GPIO11), MISO->pin21(GPIO9), MOSI->pin19(GPIO10), GND, 3V3." << endl;
+      cerr << "# DIAG: DRDY level=" << (int)io_gpio_lev( DRDY )
+           << " CS level=" << (int)io_gpio_lev( SPICS )
+           << " RST level=" << (int)io_gpio_lev( RST ) << endl;
     }
-    return 3;
-  }
 
-  if( ! adc.CfgADC( gain_idx, drate_idx ) ) {
-    cerr << "Fail to config ADC" << endl;
-    return 5;
-  }
+    uint8_t id = adc.ReadChipID();
+    if( id != 3 )  {
+      cerr << "Bad chip ID " << (int)id << " (expected 3)." << endl;
+      if( do_diag ) {
+        cerr << "# Hint: Check wiring: DRDY->pin11(GPIO17), RST->pin12(GPIO18), CS->pin15(GPIO22), SCLK->pin23(GPIO11), MISO->pin21(GPIO9), MOSI->pin19(GPIO10), GND, 3V3." << endl;
+      }
+      return 3;
+    }
 
-  if( do_probe ) {
-    cerr << "# Probe mode: capturing a few samples..." << endl;
-    // Force a small number of iterations ignoring -n
-    uint32_t samples = std::min<uint32_t>( N, 10 );
-    for( uint32_t pi = 0; pi < samples; ++pi ) {
-      adc.measureLine();
-      cout << "probe";
-      for( auto v : adc.getVolts() ) {
-        cout << ' ' << v;
+    if( ! adc.syncRegs() ) {
+      cerr << "Fail to read ADC registers" << endl;
+      return 4;
+    }
+
+    if( ! adc.CfgADC( gain_idx, drate_idx ) ) {
+      cerr << "Fail to config ADC" << endl;
+      return 5;
+    }
+    if( debug > 0 ) {
+      cerr << "# transport: " << io_tr->name() << endl;
+      cerr << "# scan: " << ( adc.isScanBatched() ? "batched" : "generic" )
+           << ( adc.isMultiGain() ? ", per channel gain" : "" );
+      if( adc.isMultiRate() ) {
+        cerr << ", multi-rate, period " << adc.getSchedLines() << " lines";
       }
-      cout << '\n';
-      usleep( 1000 ); // small pause so user can see values
+      cerr << endl;
+    }
+    if( psd && adc.isMultiRate() ) {
+      cerr << "Error: -F needs the same rate for all channels" << endl;
+      return 1;
+    }
+
+    if( do_probe ) {
+      cerr << "# Probe mode: capturing a few samples..." << endl;
+      // Force a small number of iterations ignoring -n
+      uint32_t samples = std::min<uint32_t>( N, 10 );
+      for( uint32_t pi = 0; pi < samples; ++pi ) {
+        adc.measureLine();
+        cout << "probe";
+        for( auto v : adc.getVolts() ) {
+          cout << ' ' << v;
+        }
+        cout << '\n';
+        usleep( 1000 ); // small pause so user can see values
+      }
+      close_hw();
+      if( io_mode == IO_RECORD ) {
+        io_trace.dump( trace_fn );
+      }
+      return 0;
     }
-    bcm2835_spi_end();
-    bcm2835_close();
-    return 0;
   }
 
-  struct timespec ts0, ts1, tsc;
-  clock_gettime( CLOCK_MONOTONIC, &ts0 ); ts1 = ts1; // just to make GCC happy
+  struct timespec ts0, tsc;
+  clock_gettime( CLOCK_MONOTONIC, &ts0 );
+  PeriodicSched sched( t_dly_ns, sched_pol );
+  const bool do_sched = ! do_cap && io_mode != IO_REPLAY;
 
   drop_root_cap();
 
-  ofstream os;
-  if( ! ofn.empty() ) {
-    os.open( ofn );
-    if( os ) {
-      do_fout = true;
-    }
+  // real time: outputs never block the loop; -j writes on coordinator thread, -I/-Y may wait
+  const bool async_out = do_sched && n_workers == 0;
+  FdOut fout, scr;
+  if( ! ofn.empty() && fout.open( ofn, async_out ) ) {
+    do_fout = true;
   }
+  ostream os( &fout );
+  scr.openStdout( async_out );
+  struct CoutRestore {
+    streambuf *b;
+    ~CoutRestore() { cout.flush(); cout.rdbuf( b ); }
+  } cout_restore { cout.rdbuf( &scr ) };
 
   string obuf;
   obuf.reserve( 256 );
   ostringstream s_os( obuf ); // .str( )
+  s_os << showpoint; // set by fmt_line() too, but not with -j
 
   os << "# start" << endl;
   DO_OUT;
+  LineOut lout { s_os, os, v_sums, v_sums2, v_cnts, q_level, do_fout, do_stat, do_dtime };
 
-  signal( SIGINT, sigint_handler );
-
+  EvLoop ev; // before any thread: signals go to signalfd only
+  if( ! ev.init() ) {
+    return 1;
+  }
+  ev.addOut( &scr );
+  if( do_fout ) {
+    ev.addOut( &fout );
+  }
+  if( psd ) {
+    psd->start();
+  }
+  if( ! telem_fn.empty() || ! telem_sock.empty() ) {
+    if( ! telem.start( telem_fn, telem_sock ) ) {
+      return 1;
+    }
+  }
+  unique_ptr<CtlServer> ctl;
+  if( ! ctl_sock.empty() ) {
+    ctl.reset( new CtlServer );
+    if( ! ctl->start( ctl_sock ) ) {
+      return 1;
+    }
+    ctl->setStatus( cfg_str( cur_cfg ) + " ch_n= " + to_string( ch_n ) );
+  }
+  string reconf_mark;    // to output before the first line with new configuration
+  double reconf_t = 0;   // start time of the last line before it
+
+  unique_ptr<WorkPool> pool;
+  unique_ptr<LineProc> lproc;
+  uint64_t pool_dropped = 0; // lines dropped by previous LineProc: reconfiguration
+  if( n_workers > 0 ) { // acquisition stays on current CPU, others for workers
+    int acq_cpu = sched_getcpu();
+    if( acq_cpu >= 0 ) {
+      cpu_set_t cs;
+      CPU_ZERO( &cs ); CPU_SET( acq_cpu, &cs );
+      sched_setaffinity( 0, sizeof(cs), &cs );
+    }
+    pool.reset( new WorkPool( n_workers, acq_cpu ) );
+    lproc.reset( new LineProc( *pool, ch_n, v_sums, v_sums2, v_cnts, do_stat, do_dtime, q_level, os, do_fout ) );
+    lproc->setGains( do_gains );
+    lproc->start();
+  }
+  double cap_t0 = 0;
+  double t_last = 0; // time of last line start
+  double t_lost = 0; // lines with lost values: timeouts and recovery
+  uint64_t bad_lines = 0;
 
+  bool loop_stop = false; // "stop" from control socket
   uint32_t i_n = 0; // need outside
-  for( ; i_n < N && ! break_loop; ++i_n ) {
+  for( ; i_n < N && ! loop_stop && ! ev.stopReq(); ++i_n ) {
 
+    if( i_n > 0 && do_sched ) {
+      ev.waitUntil( sched.advance() ); // signals and outputs meanwhile
+      if( ev.stopReq() ) {
+        break;
+      }
+      sched.wake( mono_now_ns() );
+    } else if( ( i_n & 255 ) == 0 ) { // not real time: look at signals now and then
+      ev.waitUntil( 0 );
+    }
     clock_gettime( CLOCK_MONOTONIC, &tsc );
     if( i_n == 0 ) {
-      ts0 = tsc; ts1 = tsc;
+      ts0 = tsc;
+      sched.start( (uint64_t)tsc.tv_sec * 1000000000ull + tsc.tv_nsec );
     }
     double dt = tsc.tv_sec - ts0.tv_sec + 1e-9 * (tsc.tv_nsec - ts0.tv_nsec);
+    t_last = dt;
 
-    adc.measureLine();
-
-    double dt0 = i_n * t_dly * 0.001;
-    double rdt = dt - dt0;
-
-    // s_os << setfill('0') << setw(8) << i_n << ' ' << showpoint  << setw(12) << setprecision(8) ;
-    s_os << showpoint  << setw(12) << setprecision(8);
-
-    if( do_dtime ) {
-      s_os << dt0; //  << ' ' << rdt;
+    double dt0, rdt;
+    if( do_cap ) {
+      if( ! cap.readLine() ) {
+        break;
+      }
+      if( i_n == 0 ) {
+        cap_t0 = cap.getT();
+      }
+      dt0 = cap.getT(); rdt = cap.getRdt(); dt = dt0;
     } else {
-      s_os << dt;
+      io_mark( IoTrace::MARK_LINE );
+      adc.measureLine();
+      if( io_mode == IO_REPLAY && io_trace.ended() ) { // incomplete line
+        break;
+      }
+      if( adc.getRecStats().bad_lines != bad_lines ) {
+        bad_lines = adc.getRecStats().bad_lines;
+        t_lost += 1e-9 * ( mono_now_ns() - ( (uint64_t)tsc.tv_sec * 1000000000ull + tsc.tv_nsec ) );
+      }
+      // late or skipped lines are labeled by real tick
+      dt0 = do_sched ? sched.tickTime() : i_n * t_dly_ns * 1e-9;
+      rdt = dt - dt0;
+    }
+    const vector<double> &volts = do_cap ? cap.getVolts() : adc.getVolts();
+    const vector<uint8_t> *gains = nullptr;
+    if( do_gains ) {
+      gains = do_cap ? &cap.getGains() : &adc.getGains();
     }
 
+    if( psd ) {
+      psd->push( volts );
+    }
 
-    {
-      int i=0;
-      for( auto v : adc.getVolts() ) {
-        s_os << ' ' << DEF_PREC << v;
-        if( do_stat ) {
-          v_sums[i]  += v;
-          v_sums2[i] += v*v;
-        }
-        ++i;
-      }
+    telem.add( Telemetry::LINES );
+    if( telem.snapReq() ) { // once per export period
+      publish_telem( sched, psd.get(), adc );
+      telem.snapDone();
     }
 
-    s_os << ' ' << setfill('0') << setw(8) << i_n;
-    if( do_dtime ) {
-      s_os << ' ' << rdt;
+    if( ! reconf_mark.empty() ) { // gap: between starts of lines with old and new config
+      s_os << reconf_mark << " gap_us= " << (int64_t)( ( dt - reconf_t ) * 1e6 ) << endl;
+      DO_OUT;
+      reconf_mark.clear();
+    }
+
+    if( lproc ) {
+      lproc->push( do_dtime ? dt0 : dt, volts, i_n, rdt, gains );
+    } else {
+      lout.put( do_dtime ? dt0 : dt, volts, i_n, rdt, gains );
     }
-    s_os << endl;
-    DO_OUT;
 
     // if( q_level < 1 ) {
     //   cout << s_os.str();
@@ -939,42 +577,211 @@ int main( int argc, char **argv )
     //   os << s_os.str();
     // }
 
-    ts1.tv_sec  += t_add_sec;
-    ts1.tv_nsec += t_add_ns;
-    if( ts1.tv_nsec > 1000000000L ) {
-      ts1.tv_nsec -=  1000000000L;
-      ++ts1.tv_sec;
+    const bool dump_req = ev.takeUsr1();
+    if( io_mode == IO_RECORD && ( dump_req || io_trace.needDump() ) ) {
+      io_trace.dump( trace_fn + '.' + to_string( trace_dumps++ ) );
+      io_trace.clearNeedDump();
+    }
+    if( ev.takeHup() ) { // outputs are already reopened
+      cerr << "# SIGHUP: outputs reopened" << endl;
+      if( do_stat && ! lproc ) { // -j: sums are in work
+        dump_stats( cerr, i_n + 1 - i_n_stat, v_sums, v_sums2, v_cnts );
+      }
+    }
+    if( ctl ) { // daemon: between two lines
+      if( ctl->stopReq() ) {
+        loop_stop = true;
+      }
+      CtlServer::Request rq;
+      if( ctl->pending() && ctl->takeRequest( rq ) ) {
+        const uint64_t t_a = mono_now_ns();
+        const auto rs0 = adc.getRegStats();
+        string err;
+        const int old_ch_n = ch_n;
+        if( ! reconf_adc( adc, cur_cfg, rq, err ) ) {
+          ctl->reply( rq.seq, "error " + err );
+        } else {
+          ch_n = adc.get_ch_n();
+          const uint64_t apply_us = ( mono_now_ns() - t_a ) / 1000;
+          const auto &rs = adc.getRegStats();
+          ostringstream m;
+          m << "# reconf " << cfg_str( cur_cfg ) << " ch_n= " << ch_n << " apply_us= " << apply_us
+            << " wreg_bursts= " << rs.bursts - rs0.bursts << " wreg_bytes= " << rs.bytes_sent - rs0.bytes_sent;
+          ctl->setStatus( cfg_str( cur_cfg ) + " ch_n= " + to_string( ch_n ) ); // before reply: "get" after "set" sees it
+          ctl->reply( rq.seq, "ok" + m.str().substr( 8 ) );
+          reconf_mark = m.str(); reconf_t = dt;
+          // statistics are for the new configuration only
+          if( lproc ) {
+            lproc->stop();
+          }
+          v_sums.assign( ch_n, 0.0 ); v_sums2.assign( ch_n, 0.0 ); v_cnts.assign( ch_n, 0 );
+          i_n_stat = i_n + 1;
+          if( lproc && ch_n != old_ch_n ) {
+            pool_dropped += lproc->getDroppedLines();
+            lproc.reset( new LineProc( *pool, ch_n, v_sums, v_sums2, v_cnts, do_stat, do_dtime, q_level, os, do_fout ) );
+            lproc->setGains( do_gains );
+            lproc->setLinesDone( i_n + 1 );
+          }
+          if( lproc ) {
+            lproc->start();
+          }
+        }
+      }
+    }
+
+    if( do_cap && cap_pace ) { // original rate: by capture time stamps
+      const double t_next = cap.getT() - cap_t0;
+      ev.waitUntil( (uint64_t)ts0.tv_sec * 1000000000ull + ts0.tv_nsec + (uint64_t)( t_next * 1e9 ) );
+    }
+  }
+
+  if( lproc ) {
+    lproc->stop();
+    pool_dropped += lproc->getDroppedLines();
+    if( debug > 0 || do_stat ) {
+      pool->report( cerr );
+    }
+    if( pool_dropped > 0 || debug > 0 ) {
+      cerr << "# pool: dropped_lines= " << pool_dropped << endl;
     }
-    clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts1, 0 );
   }
 
   cout << endl;
   if( do_fout ) {
     os << endl;
   }
-  if( break_loop ) {
+  if( loop_stop || ev.stopReq() ) {
     cerr << "Loop was terminated" << endl;
   }
+  if( psd ) {
+    psd->stop();
+  }
+  if( ctl ) {
+    ctl->stop();
+  }
+  if( telem.isActive() ) {
+    publish_telem( sched, psd.get(), adc );
+    telem.stop();
+  }
+
+  if( do_cap ) {
+    clock_gettime( CLOCK_MONOTONIC, &tsc );
+    double t_run = tsc.tv_sec - ts0.tv_sec + 1e-9 * (tsc.tv_nsec - ts0.tv_nsec);
+    if( t_run <= 0 ) {
+      t_run = 1e-9;
+    }
+    cerr << "# input: lines= " << i_n << " samples= " << (uint64_t)(i_n) * ch_n
+         << " bad_lines= " << cap.getBadLines() << " t= " << t_run
+         << " lines/s= " << i_n / t_run << " samples/s= " << i_n * ch_n / t_run
+         << " MB/s= " << cap.getBytes() / t_run * 1e-6;
+    if( i_n > 1 ) {
+      cerr << " x_realtime= " << ( cap.getT() - cap_t0 ) / t_run;
+    }
+    cerr << endl;
+  } else {
+    close_hw();
+  }
+
+  if( io_mode == IO_RECORD ) {
+    io_trace.dump( trace_fn );
+    cerr << "# trace: events= " << io_trace.size() << " dumps= " << trace_dumps << endl;
+  } else if( io_mode == IO_REPLAY ) {
+    cerr << "# replay: events_used= " << io_trace.getReplayPos() << " diverged= " << io_trace.getDiverged();
+    if( io_trace.getDiverged() ) {
+      cerr << " first_diverged= " << io_trace.getFirstDiverged();
+    }
+    cerr << ( io_trace.ended() ? " (trace end)" : "" ) << endl;
+  }
+
+  if( do_sched && ( debug > 0 || do_stat ) ) {
+    sched.report( cerr );
+  }
+
+  const auto &rc = adc.getRecStats();
+  if( rc.bad_lines > 0 || ( ! do_cap && debug > 0 ) ) {
+    cerr << "# recovery: bad_lines= " << rc.bad_lines << " lost= " << rc.lost
+         << " soft= " << rc.soft << " hard= " << rc.hard << " failed= " << rc.failed
+         << " recover_ms= " << rc.time_ns * 1e-6 << " lost_ms= " << t_lost * 1e3 << endl;
+  }
 
-  bcm2835_spi_end();
-  bcm2835_close();
+  if( ! do_cap && adc.isMultiRate() && ( debug > 0 || do_stat ) && i_n > 0 ) {
+    // N lines take N periods; replay has no real time
+    const double t_span = do_sched ? t_last + t_dly_ns * 1e-9 : i_n * t_dly_ns * 1e-9;
+    const auto &cnts = adc.getChanCounts();
+    cerr << "# rates, Hz (channel: nominal achieved values):";
+    for( int i=0; i<ch_n; ++i ) { // -t 0: no nominal rate
+      cerr << ' ' << i << ": ";
+      if( t_dly_ns > 0 ) {
+        cerr << 1e9 / t_dly_ns / adc.getChanDiv( i ) << ' ' << cnts[i] / t_span;
+      } else {
+        cerr << "- -";
+      }
+      cerr << ' ' << cnts[i];
+    }
+    cerr << endl;
+  }
+
+  if( debug > 0 ) {
+    const auto &rs = adc.getRegStats();
+    cerr << "# regs: req= " << rs.wr_req << " elided= " << rs.elided << " bursts= " << rs.bursts
+         << " bytes_sent= " << rs.bytes_sent << " bytes_saved= " << rs.bytesSaved()
+         << " verify_fail= " << rs.verify_fail << endl;
+    if( adc.isMultiGain() ) {
+      cerr << "# gain_switches= " << adc.getGainSwitches() << endl;
+    }
+    if( io_mode == IO_DIRECT && ! do_cap ) {
+      const auto &ts = io_tr->getStats();
+      const double n_s = max( 1.0, (double)(i_n) * ch_n );
+      cerr << "# transport: " << io_tr->name() << " ops= " << ts.ops << " syscalls= " << ts.syscalls
+           << " bytes= " << ts.bytes << " batches= " << ts.batches
+           << " ops/sample= " << ts.ops / n_s << " syscalls/sample= " << ts.syscalls / n_s
+           << " bytes/sample= " << ts.bytes / n_s << " drdy_sleeps= " << ts.edge_waits << endl;
+    }
+  }
 
   if( do_stat ) {
     s_os.str(""); s_os.clear();
-    s_os << "## Statistics: (n=" << i_n << ") avarages:" << endl;
+    s_os << "## Statistics: (n=" << i_n - i_n_stat << ") avarages:" << endl;
     DO_OUT;
-    for( auto v : v_sums ) {
-      s_os << "# " << DEF_PREC << ( v / i_n ) << ' ';
+    for( unsigned i=0; i<v_sums.size(); ++i ) {
+      s_os << "# " << DEF_PREC << ( v_sums[i] / v_cnts[i] ) << ' ';
     }
     s_os << endl;
     DO_OUT;
 
     s_os << "## Std deviations:" << endl;
     for( unsigned i=0; i<v_sums.size(); ++i ) {
-      s_os << "# " << DEF_PREC << sqrt(  v_sums2[i] * i_n - v_sums[i] * v_sums[i]  ) / i_n << ' ';
+      const uint32_t n = v_cnts[i];
+      s_os << "# " << DEF_PREC << sqrt(  v_sums2[i] * n - v_sums[i] * v_sums[i]  ) / n << ' ';
     }
     s_os << endl;
     DO_OUT;
+
+    if( psd ) {
+      s_os << "## PSD noise density [" << psd->getBandF1() << ',' << psd->getBandF2()
+           << "] Hz, V/sqrt(Hz): (segs=" << psd->getSegs() << " dropped=" << psd->getDropped()
+           << " lost_segs=" << psd->getLostSegs() << ")" << endl;
+      for( int i=0; i<ch_n; ++i ) {
+        s_os << "# " << DEF_PREC << psd->noiseDensity( i ) << ' ';
+      }
+      s_os << endl;
+      s_os << "## PSD rms in band, V:" << endl;
+      for( int i=0; i<ch_n; ++i ) {
+        s_os << "# " << DEF_PREC << psd->bandRms( i ) << ' ';
+      }
+      s_os << endl;
+      DO_OUT;
+    }
+  }
+
+  if( debug > 0 ) { // after the last text: byte counters include the final flush
+    cout.flush();
+    scr.close(); fout.close();
+    const auto &es = ev.getStats();
+    cerr << "# evloop: waits= " << es.waits << " timer= " << es.timer << " signals= " << es.signals
+         << " out_ready= " << es.out_ready << " screen_bytes= " << scr.getWritten()
+         << " screen_dropped= " << scr.getDropped() << " file_bytes= " << fout.getWritten()
+         << " file_dropped= " << fout.getDropped() << endl;
   }
 
   return 0;
@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <iostream>
+
+#include "ads_capture.h"
+#include "ads_out.h"
+
+using namespace std;
+
+CaptureReader::CaptureReader()
+  : buf( 1 << 20 )
+{
+  volts.reserve( 32 ); toks.reserve( 40 );
+}
+
+/*
+ *  name: CaptureReader::open
+ *  function: open capture file and read first data line to find number of channels
+ *  The return value: number of channels, 0 - error
+ */
+int CaptureReader::open( const string &fn )
+{
+  is.rdbuf()->pubsetbuf( buf.data(), buf.size() );
+  is.open( fn );
+  if( ! is ) {
+    cerr << "Error: fail to open capture \"" << fn << "\"" << endl;
+    return 0;
+  }
+  ch_n = 0;
+  int n = readLine();
+  if( n < 1 ) {
+    cerr << "Error: no data in capture \"" << fn << "\"" << endl;
+    return 0;
+  }
+  ch_n = n;
+  peeked = true;
+  return n;
+}
+
+int CaptureReader::readLine()
+{
+  if( peeked ) {
+    peeked = false;
+    return ch_n;
+  }
+  while( getline( is, line ) ) {
+    bytes += line.size() + 1;
+    if( line.empty() || line[0] == '#' ) {
+      continue;
+    }
+    int n = parseLine();
+    if( n > 0 && ( ch_n == 0 || n == ch_n ) ) {
+      return n;
+    }
+    ++bad_lines;
+  }
+  return 0;
+}
+
+int CaptureReader::parseLine()
+{
+  toks.clear(); gains.clear();
+  int idx_tok = -1; // last token with only digits
+  const char *p = line.c_str();
+  while( *p ) {
+    while( *p == ' ' || *p == '\t' || *p == '\r' ) {
+      ++p;
+    }
+    if( ! *p ) {
+      break;
+    }
+    const char *b = p;
+    if( *b == 'x' ) { // applied gain, written with -G
+      gains.push_back( (uint8_t)( strtoul( b+1, nullptr, 10 ) ) );
+      while( *p && *p != ' ' && *p != '\t' && *p != '\r' ) {
+        ++p;
+      }
+      continue;
+    }
+    bool only_dig = true;
+    while( *p && *p != ' ' && *p != '\t' && *p != '\r' ) {
+      only_dig &= ( isdigit( (unsigned char)(*p) ) != 0 );
+      ++p;
+    }
+    if( p - b == 1 && ( *b == '-' || *b == '*' ) ) { // value not measured in this line or lost
+      toks.push_back( ( *b == '-' ) ? NAN : v_lost );
+      continue;
+    }
+    char *e;
+    double v = strtod( b, &e );
+    if( e != p ) {
+      return 0;
+    }
+    if( only_dig ) {
+      idx_tok = toks.size();
+    }
+    toks.push_back( v );
+  }
+
+  if( idx_tok < 2 ) { // t, at least one value, i_n
+    return 0;
+  }
+  t   = toks[0];
+  i_n = (uint32_t)( toks[idx_tok] );
+  rdt = ( (unsigned)(idx_tok) + 1 < toks.size() ) ? toks[idx_tok+1] : 0.0;
+  volts.assign( toks.begin() + 1, toks.begin() + idx_tok );
+  return volts.size();
+}
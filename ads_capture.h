@@ -0,0 +1,43 @@
+#ifndef _ADS_CAPTURE_H
+#define _ADS_CAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+// Reader of text captures, written by ads1256_da -o:
+// "t v_0 ... v_n-1 i_n [rdt] [x<gain> ...]", lines started with '#' are skipped,
+// '-' is value not measured in this line (multi-rate), it is read as NaN,
+// '*' - lost value, read as negative NaN.
+// Values are printed with showpoint, so i_n is the last token with only digits.
+
+class CaptureReader {
+  public:
+   CaptureReader();
+   int open( const std::string &fn );
+   int readLine(); // number of values, 0 - EOF
+   int get_ch_n() const { return ch_n; }
+   const std::vector<double>& getVolts() const { return volts; }
+   const std::vector<uint8_t>& getGains() const { return gains; } // empty, if not in capture
+   double getT()   const { return t; }
+   double getRdt() const { return rdt; }
+   uint32_t getIdx() const { return i_n; }
+   uint64_t getBytes() const { return bytes; }
+   uint64_t getBadLines() const { return bad_lines; }
+  protected:
+   std::ifstream is;
+   std::string line;
+   std::vector<double> volts, toks;
+   std::vector<uint8_t> gains;
+   std::vector<char> buf; // stream buffer
+   int ch_n = 0; // from first data line
+   double t = 0, rdt = 0;
+   uint32_t i_n = 0;
+   uint64_t bytes = 0, bad_lines = 0;
+   bool peeked = false;
+
+   int parseLine();
+};
+
+#endif
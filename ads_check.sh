@@ -0,0 +1,440 @@
+#!/bin/bash
+# Functional checks against the fake ADS1256 model (-B fake, no hardware):
+# make check, results in test_output.txt.
+
+BIN=${BIN:-./ads1256_da}
+TMP=$(mktemp -d /tmp/ads_check.XXXXXX)
+trap 'rm -rf "$TMP"' EXIT
+export BCM_FAKE_DELAY=${BCM_FAKE_DELAY:-0}
+
+n_fail=0
+
+ok()   { echo "ok   $1"; }
+fail() { echo "FAIL $1: $2"; n_fail=$(( n_fail + 1 )); }
+
+# send one line to control socket $1, print the answer
+ctl()
+{
+  python3 -c 'import socket,sys
+s = socket.socket( socket.AF_UNIX ); s.connect( sys.argv[1] )
+s.sendall( ( sys.argv[2] + "\n" ).encode() ); print( s.makefile().readline().strip() )' "$1" "$2"
+}
+
+wait_sock()
+{
+  for i in $(seq 50); do
+    [ -S "$1" ] && return 0
+    sleep 0.1
+  done
+  return 1
+}
+
+# values written to register $2 in -R trace $1, one per line: WREG bursts
+# are decoded from SPI out bytes, CS high ends a command
+trace_wreg()
+{
+  python3 -c 'import struct,sys
+d = open( sys.argv[1], "rb" ).read(); reg = int( sys.argv[2] )
+n = struct.unpack_from( "<I", d, 8 )[0]
+st = None; r = 0; left = 0
+for k in range( n ):
+  dt, t, a, b, rep = struct.unpack_from( "<IBBBB", d, 24 + 8*k )
+  if t == 2 and a == 8 and b == 1:
+    st = None
+  if t != 1:
+    continue
+  if st is None:
+    if a & 0xF0 in ( 0x50, 0x10 ):
+      st = ( "wn" if a & 0xF0 == 0x50 else "rn" ); r = a & 0x0F
+    elif a == 0x01:
+      st = "rd"; left = 3
+  elif st in ( "wn", "rn" ):
+    left = ( a & 0x0F ) + 1; st = st[0]
+  elif st == "w":
+    if r == reg:
+      print( hex( a ) )
+    r += 1; left -= 1
+    st = st if left else None
+  else:
+    left -= 1
+    st = st if left else None' "$1" "$2"
+}
+
+# lines are data lines: not "#..." and not empty
+data_lines() { grep -c '^ *[0-9]' "$1"; }
+
+# output without the last column of data lines: measured scan time
+values() { awk '/^ *[0-9]/ { NF-- } 1' "$1"; }
+
+# -j: coordinator must go on after reconfiguration with the same ch_n
+check_reconf_pool()
+{
+  local name=reconf_pool f="$TMP/rp.txt" s="$TMP/rp.sock"
+  $BIN -B fake -j 2 -c 4 -t 5 -n 300 -q 2 -o "$f" -Z "$s" >/dev/null 2>"$TMP/rp.err" &
+  local pid=$!
+  wait_sock "$s" || { fail $name "no control socket"; kill $pid; return; }
+  sleep 0.3
+  local r=$( ctl "$s" "set g=2" )
+  local g=$( ctl "$s" "get" )
+  wait $pid
+  case "$r" in ok*) ;; *) fail $name "set: $r"; return ;; esac
+  case "$g" in *" g= 2 "*) ;; *) fail $name "get after set: $g"; return ;; esac
+  local after=$( sed -n '/^# reconf/,$p' "$f" | grep -c '^ *[0-9]' )
+  if [ "$after" -lt 100 ]; then
+    fail $name "only $after lines after reconf"
+    return
+  fi
+  ok $name
+}
+
+# rejected spec: multi-rate schedule and scan function must stay
+check_reconf_reject()
+{
+  local name=reconf_reject f="$TMP/rr.txt" s="$TMP/rr.sock"
+  $BIN -B fake -C 0,1/4 -t 10 -n 200 -q 2 -o "$f" -Z "$s" >/dev/null 2>"$TMP/rr.err" &
+  local pid=$!
+  wait_sock "$s" || { fail $name "no control socket"; kill $pid; return; }
+  sleep 0.2
+  local r=$( ctl "$s" "set C=0,9" )
+  wait $pid
+  case "$r" in error*) ;; *) fail $name "set: $r"; return ;; esac
+  local skipped=$( awk '$1 ~ /^[0-9]/ && $3 == "-"' "$f" | wc -l )
+  if [ "$skipped" -lt 140 ]; then
+    fail $name "channel 1 not measured in $skipped lines of 200, expected 150"
+    return
+  fi
+  ok $name
+}
+
+# lost values (DRDY stuck till RST) must not spoil PSD
+check_psd_lost()
+{
+  local name=psd_lost f="$TMP/pl.txt"
+  BCM_FAKE_FAULT=200:2 $BIN -B fake -n 600 -t 0.5 -F 32 -S -q 2 -o "$f" >/dev/null 2>"$TMP/pl.err"
+  if grep -qi nan <( sed -n '/^## PSD/,$p' "$f" ); then
+    fail $name "NaN in PSD"
+    return
+  fi
+  grep -q 'lost_segs=[1-9]' "$f" || { fail $name "no lost segments counted"; return; }
+  ok $name
+}
+
+# DRDY stuck till RST: line stops at the first timeout, lost time is bounded
+check_fault_bound()
+{
+  local name=fault_bound
+  local r=$( BCM_FAKE_FAULT=200:2 $BIN -B fake -n 60 -t 50 -d -q 2 2>&1 >/dev/null | grep '^# recovery:' )
+  local hard=$( echo "$r" | sed -n 's/.* hard= \([0-9]*\).*/\1/p' )
+  local lost_ms=$( echo "$r" | sed -n 's/.* lost_ms= \([0-9]*\).*/\1/p' )
+  if [ "${hard:-0}" -lt 1 ] || [ "${lost_ms:-999}" -gt 100 ]; then
+    fail $name "$r"
+    return
+  fi
+  ok $name
+}
+
+# DRDY stuck till SDATAC: soft recovery must fire
+check_fault_soft()
+{
+  local name=fault_soft
+  local r=$( BCM_FAKE_FAULT=20:1 $BIN -B fake -n 20 -t 5 -d -q 2 2>&1 >/dev/null | grep '^# recovery:' )
+  local soft=$( echo "$r" | sed -n 's/.* soft= \([0-9]*\).*/\1/p' )
+  local failed=$( echo "$r" | sed -n 's/.* failed= \([0-9]*\).*/\1/p' )
+  if [ "${soft:-0}" -lt 1 ] || [ "${failed:-1}" -ne 0 ]; then
+    fail $name "${r:-no recovery}"
+    return
+  fi
+  ok $name
+}
+
+# hard recovery: registers never set (IO) keep power-up value 0xE0, the
+# set ones are restored also after a failed soft read-back (mode 3)
+check_fault_io()
+{
+  local name=fault_io t="$TMP/fi.trace" m
+  for m in 2 3; do
+    local r=$( BCM_FAKE_FAULT=50:$m $BIN -B fake -c 4 -n 30 -t 5 -d -q 2 -R "$t" 2>&1 >/dev/null | grep '^# recovery:' )
+    case "$r" in *" hard= 0 "*|*" failed= "[1-9]*|"") fail $name "mode $m: $r"; return ;; esac
+    local io=$( trace_wreg "$t" 4 | sort -u | tr '\n' ' ' )
+    if [ -n "$io" ] && [ "$io" != "0xe0 " ]; then
+      fail $name "mode $m: IO written: $io"
+      return
+    fi
+  done
+  ok $name
+}
+
+# -t 0: free running as before the scheduler, nothing is missed
+check_sched_free()
+{
+  local name=sched_free
+  local r=$( $BIN -B fake -c 2 -n 200 -t 0 -p skip -d -q 2 2>&1 >/dev/null | grep '^# sched:' )
+  case "$r" in
+    *" ticks= 200 missed= 0 skipped= 0 "*) ok $name ;;
+    *) fail $name "${r:-rejected}" ;;
+  esac
+}
+
+# one channel: MISO stuck at 1 is found by codes in a row over lines
+check_stuck_one()
+{
+  local name=stuck_one f="$TMP/so.txt"
+  local r=$( BCM_FAKE_FAULT=20:3 $BIN -B fake -c 1 -n 60 -t 1 -d -q 2 -o "$f" 2>&1 >/dev/null | grep '^# recovery:' )
+  case "$r" in *" hard= 0 "*|*" failed= "[1-9]*|"") fail $name "${r:-no recovery}"; return ;; esac
+  grep -q '^ *[0-9.e+-]* \* ' "$f" || { fail $name "no lost value in output"; return; }
+  ok $name
+}
+
+# -b: reversed or too high band is rejected, a valid one gives numbers
+check_psd_band()
+{
+  local name=psd_band f="$TMP/pb.txt" b
+  for b in 100:10 10:10 10:600; do
+    if $BIN -B fake -c 1 -n 100 -t 1 -F 32 -b $b -q 2 >/dev/null 2>&1; then
+      fail $name "band $b accepted"
+      return
+    fi
+  done
+  $BIN -B fake -c 1 -n 200 -t 1 -F 32 -b 100:200 -S -q 2 -o "$f" >/dev/null 2>&1
+  if ! grep -q '^## PSD noise' "$f" || grep -qi nan <( sed -n '/^## PSD/,$p' "$f" ); then
+    fail $name "no PSD numbers for 100:200"
+    return
+  fi
+  ok $name
+}
+
+# -c 4: per line the MUX write of line start is elided (set by the last read),
+# every read writes MUX of the next channel in its own burst
+check_regs_elide()
+{
+  local name=regs_elide n
+  local -a v
+  for n in 20 40; do
+    v+=( $( $BIN -B fake -c 4 -n $n -t 0 -d -q 2 2>&1 >/dev/null |
+            sed -n 's/^# regs: req= \([0-9]*\) elided= \([0-9]*\) bursts= \([0-9]*\) .*/\1 \2 \3/p' ) )
+  done
+  local d="$(( v[3] - v[0] )) $(( v[4] - v[1] )) $(( v[5] - v[2] ))"
+  if [ ${#v[@]} -ne 6 ] || [ "$d" != "100 20 80" ]; then
+    fail $name "20 lines: req/elided/bursts +$d, expected +100 20 80"
+    return
+  fi
+  ok $name
+}
+
+# batched scan (fake:batch) and generic scan give the same values
+check_scan_same()
+{
+  local name=scan_same f="$TMP/ss" b
+  for b in fake fake:batch; do
+    $BIN -B $b -c 4 -n 50 -t 1 -d -q 2 -o "$f.$b" >/dev/null 2>"$f.$b.err"
+  done
+  grep -q '^# scan: batched' "$f.fake:batch.err" || { fail $name "fake:batch did not use batched scan"; return; }
+  if ! cmp -s <( values "$f.fake" ) <( values "$f.fake:batch" ); then
+    fail $name "batched and generic scan differ"
+    return
+  fi
+  ok $name
+}
+
+# -R trace replayed by -Y: no divergence, same output
+check_replay()
+{
+  local name=replay t="$TMP/rp.trace" f="$TMP/rp"
+  $BIN -B fake -c 4 -n 50 -t 1 -q 2 -R "$t" -o "$f.rec" >/dev/null 2>&1
+  local r=$( $BIN -B fake -c 4 -n 50 -t 1 -d -q 2 -Y "$t" -o "$f.rep" 2>&1 >/dev/null | grep '^# replay:' )
+  case "$r" in *" diverged= 0") ;; *) fail $name "${r:-no replay}"; return ;; esac
+  if [ "$( data_lines "$f.rep" )" -ne 50 ] || ! cmp -s <( values "$f.rec" ) <( values "$f.rep" ); then
+    fail $name "replayed output differs"
+    return
+  fi
+  ok $name
+}
+
+# -o capture (with lost values) read back by -I gives the same file
+check_capture()
+{
+  local name=capture f="$TMP/cp"
+  BCM_FAKE_FAULT=30:2 $BIN -B fake -c 4 -n 60 -t 1 -q 2 -o "$f.1" >/dev/null 2>&1
+  grep -q '\*' "$f.1" || { fail $name "no lost value in capture"; return; }
+  if ! $BIN -I "$f.1" -q 2 -o "$f.2" >/dev/null 2>&1 || ! cmp -s "$f.1" "$f.2"; then
+    fail $name "-I output differs from capture"
+    return
+  fi
+  ok $name
+}
+
+# fake tone of 16 samples at 1 kHz: PSD peak in bin 4 of 64 (62.5 Hz)
+check_psd_tone()
+{
+  local name=psd_tone f="$TMP/pt.txt"
+  BCM_FAKE_TONE=16 $BIN -B fake -c 1 -n 600 -t 1 -F 64 -f "$f" -q 2 >/dev/null 2>&1
+  local pk=$( awk '$1 !~ /^#/ && NF == 2 && $2 > m { m = $2; f = $1 } END { print f }' "$f" 2>/dev/null )
+  if [ "$pk" != "62.5" ]; then
+    fail $name "peak at ${pk:-none} Hz, expected 62.5"
+    return
+  fi
+  ok $name
+}
+
+# -j 3: values and statistics are the same as without workers
+check_pool_same()
+{
+  local name=pool_same f="$TMP/ps"
+  $BIN -B fake -c 4 -n 300 -t 0.5 -S -q 2 -o "$f.0" >/dev/null 2>&1
+  $BIN -B fake -c 4 -n 300 -t 0.5 -S -j 3 -q 2 -o "$f.3" >/dev/null 2>&1
+  grep -q '^## Statistics' "$f.3" || { fail $name "no statistics with -j 3"; return; }
+  if [ "$( data_lines "$f.3" )" -ne 300 ] || ! cmp -s <( values "$f.0" ) <( values "$f.3" ); then
+    fail $name "-j 3 output differs from serial"
+    return
+  fi
+  ok $name
+}
+
+# 50 us period with real fake delays: every line is late, counters by policy
+check_sched_late()
+{
+  local name=sched_late p r
+  local -A want=( [catchup]="ticks= 40 missed= [1-9][0-9]* skipped= 0 stretched_ms= 0 "
+                  [skip]="ticks= ([0-9]+) missed= [1-9][0-9]* skipped= ([1-9][0-9]*) stretched_ms= 0 "
+                  [stretch]="ticks= 40 missed= [1-9][0-9]* skipped= 0 stretched_ms= [1-9]" )
+  for p in catchup skip stretch; do
+    r=$( BCM_FAKE_DELAY=1 $BIN -B fake -c 4 -n 40 -t 0.05 -p $p -d -q 2 2>&1 >/dev/null | grep '^# sched:' )
+    if ! [[ "$r" =~ ${want[$p]} ]]; then
+      fail $name "${r:-no sched for $p}"
+      return
+    fi
+    if [ $p = skip ] && [ $(( BASH_REMATCH[1] - BASH_REMATCH[2] )) -ne 40 ]; then
+      fail $name "skip: ticks are not lines + skipped: $r"
+      return
+    fi
+  done
+  ok $name
+}
+
+# auto-ranging: fake levels 0x10000 (ch 0) and 0x40000 (ch 3) codes at gain 1
+# go up to x64 and x16 (about half scale), volts stay the same
+check_auto_gain()
+{
+  local name=auto_gain f="$TMP/ag.txt"
+  $BIN -B fake -C 0@auto,3@auto -G -n 60 -t 1 -q 2 -o "$f" >/dev/null 2>&1
+  local last=$( grep '^ *[0-9]' "$f" | tail -1 )
+  local first=$( grep '^ *[0-9]' "$f" | head -1 )
+  case "$last" in *" x64 x16") ;; *) fail $name "gains at end: ${last:-no data}"; return ;; esac
+  if ! echo "$first $last" | awk '{ exit !( ( $2 - $9 )^2 < ( $2 / 100 )^2 && ( $3 - $10 )^2 < ( $3 / 100 )^2 ) }'; then
+    fail $name "volts changed with gain: $first / $last"
+    return
+  fi
+  ok $name
+}
+
+# -C 0,1/2,2/4: channel 1 in even lines, channel 2 in lines 1, 5, ..., '-' else
+check_multi_rate()
+{
+  local name=multi_rate f="$TMP/mr.txt"
+  $BIN -B fake -C 0,1/2,2/4 -n 16 -t 1 -q 2 -o "$f" >/dev/null 2>&1
+  local pat=$( awk '/^ *[0-9]/ { printf "%s%s%s ", ( $2 == "-" ? "-" : 0 ), ( $3 == "-" ? "-" : 1 ), ( $4 == "-" ? "-" : 2 ) }' "$f" )
+  local want=$( for i in 1 2 3 4; do printf "%s" "01- 0-2 01- 0-- "; done )
+  if [ "$pat" != "$want" ]; then
+    fail $name "measured channels by line: $pat"
+    return
+  fi
+  ok $name
+}
+
+# -M file at exit: Prometheus text format with the expected metrics
+check_prom_file()
+{
+  local name=prom_file f="$TMP/m.prom"
+  $BIN -B fake -c 2 -n 200 -t 1 -q 2 -M "$f" -o /dev/null >/dev/null 2>&1
+  local r=$( python3 -c 'import re,sys
+types = {}; vals = {}
+for l in open( sys.argv[1] ):
+  l = l.rstrip( "\n" )
+  m = re.match( r"# TYPE (\w+) (counter|gauge|summary)$", l )
+  if m:
+    types[m.group( 1 )] = m.group( 2 ); continue
+  if re.match( r"# HELP \w+ ", l ):
+    continue
+  m = re.match( r"(\w+)(\{quantile=\"[0-9.]+\"\})? (\S+)$", l )
+  if not m:
+    sys.exit( "bad line: " + l )
+  float( m.group( 3 ) )
+  base = re.sub( r"_(sum|count)$", "", m.group( 1 ) ) if m.group( 1 ) not in types else m.group( 1 )
+  if base not in types:
+    sys.exit( "no TYPE for " + m.group( 1 ) )
+  vals[m.group( 1 ) + ( m.group( 2 ) or "" )] = float( m.group( 3 ) )
+need = [ "ads_lines_total", "ads_drdy_timeouts_total", "ads_sched_missed_total",
+         "ads_sched_skipped_total", "ads_late_seconds_count", "ads_late_max_seconds",
+         "ads_spi_bytes_total", "ads_out_bytes_total", "ads_samples_lost_total",
+         "ads_recoveries_total", "ads_start_time_seconds" ]
+miss = [ n for n in need if n not in vals ]
+if miss:
+  sys.exit( "missing " + " ".join( miss ) )
+if vals["ads_lines_total"] != 200 or types["ads_late_seconds"] != "summary":
+  sys.exit( "ads_lines_total= %g" % vals["ads_lines_total"] )' "$f" 2>&1 )
+  if [ ! -s "$f" ] || [ -n "$r" ]; then
+    fail $name "${r:-no metrics file}"
+    return
+  fi
+  ok $name
+}
+
+# fake:batch sends the whole scan of every line as one batch, fake none
+check_batch_count()
+{
+  local name=batch_count b r want
+  for b in fake fake:batch; do
+    r=$( $BIN -B $b -c 4 -n 30 -t 0 -d -q 2 2>&1 >/dev/null | grep '^# transport: .* ops=' )
+    want=" batches= 0 "
+    [ $b = fake:batch ] && want=" batches= 30 "
+    case "$r" in *"$want"*) ;; *) fail $name "$b: ${r:-no transport stats}"; return ;; esac
+  done
+  ok $name
+}
+
+# SIGTERM: event loop ends, exit 0, output flushed with complete lines
+check_sigterm()
+{
+  local name=sigterm f="$TMP/st.txt"
+  $BIN -B fake -c 2 -n 100000 -t 1 -d -q 2 -o "$f" >/dev/null 2>"$TMP/st.err" &
+  local pid=$!
+  sleep 0.5
+  kill -TERM $pid
+  wait $pid
+  local rc=$? ev=$( grep '^# evloop:' "$TMP/st.err" )
+  if [ $rc -ne 0 ] || ! grep -q '^Loop was terminated' "$TMP/st.err"; then
+    fail $name "exit $rc"
+    return
+  fi
+  case "$ev" in *" signals= 1 "*" file_bytes= $( stat -c %s "$f" ) "*) ;; *) fail $name "${ev:-no evloop}"; return ;; esac
+  if [ "$( data_lines "$f" )" -lt 100 ] || [ -n "$( awk '/^ *[0-9]/ && NF != 5' "$f" )" ]; then
+    fail $name "output not complete"
+    return
+  fi
+  ok $name
+}
+
+check_reconf_pool
+check_reconf_reject
+check_psd_lost
+check_fault_bound
+check_fault_soft
+check_fault_io
+check_sched_free
+check_stuck_one
+check_psd_band
+check_regs_elide
+check_scan_same
+check_replay
+check_capture
+check_psd_tone
+check_pool_same
+check_sched_late
+check_auto_gain
+check_multi_rate
+check_prom_file
+check_batch_count
+check_sigterm
+
+echo "failed: $n_fail"
+[ $n_fail -eq 0 ]
@@ -0,0 +1,207 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <chrono>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ads_ctl.h"
+
+using namespace std;
+
+CtlServer::~CtlServer()
+{
+  stop();
+}
+
+/*
+ *  name: CtlServer::start
+ *  function: listen on Unix socket, start thread for clients
+ *  The return value: 1 - ok, 0 - error
+ */
+int CtlServer::start( const string &a_sock_fn )
+{
+  sock_fn = a_sock_fn;
+  sockaddr_un sa;
+  memset( &sa, 0, sizeof(sa) );
+  sa.sun_family = AF_UNIX;
+  if( sock_fn.size() >= sizeof(sa.sun_path) ) {
+    cerr << "Error: too long socket name \"" << sock_fn << "\"" << endl;
+    return 0;
+  }
+  strcpy( sa.sun_path, sock_fn.c_str() );
+  unlink( sock_fn.c_str() );
+  sock_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+  if( sock_fd < 0 || bind( sock_fd, (sockaddr*)(&sa), sizeof(sa) ) != 0 || listen( sock_fd, 4 ) != 0 ) {
+    cerr << "Error: fail to listen on \"" << sock_fn << "\": " << strerror( errno ) << endl;
+    if( sock_fd >= 0 ) {
+      close( sock_fd ); sock_fd = -1;
+    }
+    return 0;
+  }
+  th = thread( &CtlServer::run, this );
+  return 1;
+}
+
+void CtlServer::stop()
+{
+  if( ! th.joinable() ) {
+    return;
+  }
+  quit = true;
+  {
+    lock_guard<mutex> lk( mtx );
+    rep = "error stopped"; rep_ready = true;
+  }
+  cv.notify_all();
+  th.join();
+  close( sock_fd ); sock_fd = -1;
+  unlink( sock_fn.c_str() );
+}
+
+void CtlServer::reply( uint64_t a_seq, const string &s )
+{
+  {
+    lock_guard<mutex> lk( mtx );
+    if( a_seq != seq || ! req_pending.load( memory_order_relaxed ) ) { // client is gone
+      return;
+    }
+    rep = s; rep_ready = true;
+    req_pending.store( false, memory_order_relaxed );
+  }
+  cv.notify_all();
+}
+
+int CtlServer::takeRequest( Request &r )
+{
+  lock_guard<mutex> lk( mtx );
+  if( ! req_pending.load( memory_order_relaxed ) ) { // timed out just now
+    return 0;
+  }
+  r = req; req_taken = true;
+  return 1;
+}
+
+void CtlServer::setStatus( const string &s )
+{
+  lock_guard<mutex> lk( mtx );
+  status = s;
+}
+
+/*
+ *  name: CtlServer::parseSet
+ *  function: parse arguments of "set": C=spec c=n g=gain D=drate
+ *  The return value: 1 - ok, 0 - bad or empty
+ */
+int CtlServer::parseSet( const string &args, Request &r )
+{
+  istringstream is( args );
+  string t;
+  bool any = false;
+  while( is >> t ) {
+    auto eq = t.find( '=' );
+    if( eq == string::npos || eq + 1 >= t.size() ) {
+      return 0;
+    }
+    const string k = t.substr( 0, eq ), v = t.substr( eq+1 );
+    char *e;
+    if( k == "C" ) {
+      r.spec = v;
+    } else if( k == "c" || k == "g" || k == "D" ) {
+      long x = strtol( v.c_str(), &e, 0 );
+      if( *e || x < 1 ) {
+        return 0;
+      }
+      ( k == "c" ? r.n_ch : ( k == "g" ? r.gain : r.drate ) ) = x;
+    } else {
+      return 0;
+    }
+    any = true;
+  }
+  if( ! r.spec.empty() && r.n_ch > 0 ) {
+    return 0;
+  }
+  return any;
+}
+
+string CtlServer::command( const string &line )
+{
+  istringstream is( line );
+  string cmd;
+  is >> cmd;
+  if( cmd == "get" ) {
+    lock_guard<mutex> lk( mtx );
+    return "ok " + status;
+  }
+  if( cmd == "stop" ) {
+    stop_req = true;
+    return "ok stopping";
+  }
+  if( cmd != "set" ) {
+    return "error unknown command \"" + cmd + "\", must be set, get or stop";
+  }
+  string args;
+  getline( is, args );
+  Request r;
+  if( ! parseSet( args, r ) ) {
+    return "error bad arguments, must be: set [C=spec|c=n] [g=gain] [D=drate]";
+  }
+  unique_lock<mutex> lk( mtx );
+  req = r; req.seq = ++seq; rep_ready = false; req_taken = false;
+  req_pending.store( true, memory_order_release );
+  // loop may wait in WaitDRDY or long period: do not hang forever,
+  // but a request, taken by loop, is applied and answered in bounded time
+  if( ! cv.wait_for( lk, chrono::seconds( 30 ), [this] { return rep_ready || req_taken; } ) ) {
+    req_pending.store( false, memory_order_relaxed );
+    return "error timeout (not applied)";
+  }
+  cv.wait( lk, [this] { return rep_ready; } );
+  return rep;
+}
+
+// one client at time: read lines, answer every of them
+void CtlServer::run()
+{
+  while( ! quit ) {
+    pollfd pfd = { sock_fd, POLLIN, 0 };
+    if( poll( &pfd, 1, 100 ) <= 0 || ! ( pfd.revents & POLLIN ) ) {
+      continue;
+    }
+    int c_fd = accept4( sock_fd, nullptr, nullptr, SOCK_CLOEXEC );
+    if( c_fd < 0 ) {
+      continue;
+    }
+    string ibuf;
+    char buf[256];
+    while( ! quit ) {
+      pollfd cfd = { c_fd, POLLIN, 0 };
+      if( poll( &cfd, 1, 100 ) == 0 ) {
+        continue;
+      }
+      ssize_t n = read( c_fd, buf, sizeof(buf) );
+      if( n <= 0 ) {
+        break;
+      }
+      ibuf.append( buf, n );
+      size_t nl;
+      while( ( nl = ibuf.find( '\n' ) ) != string::npos ) {
+        string line = ibuf.substr( 0, nl );
+        ibuf.erase( 0, nl+1 );
+        if( ! line.empty() && line.back() == '\r' ) {
+          line.pop_back();
+        }
+        if( line.empty() ) {
+          continue;
+        }
+        const string a = command( line ) + '\n';
+        send( c_fd, a.data(), a.size(), MSG_NOSIGNAL );
+      }
+    }
+    close( c_fd );
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef _ADS_CTL_H
+#define _ADS_CTL_H
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Control socket of daemon mode: Unix stream socket, text lines.
+//   set [C=spec] [c=n] [g=gain] [D=drate] - new configuration, applied between two lines
+//   get                                   - current configuration
+//   stop                                  - end of acquisition
+// Every command is answered by one line: "ok ..." or "error ...".
+// Requests are taken by acquisition loop: pending() is one acquire load.
+class CtlServer {
+  public:
+   struct Request {
+     std::string spec; // -C, empty - not changed
+     int n_ch  = -1;   // -c, -1 - not changed
+     int gain  = -1;
+     int drate = -1;
+     uint64_t seq = 0; // set by command(): reply() must carry it
+   };
+   ~CtlServer();
+   int  start( const std::string &a_sock_fn );
+   void stop();
+   bool pending() const { return req_pending.load( std::memory_order_acquire ); }
+   bool stopReq() const { return stop_req.load( std::memory_order_relaxed ); }
+   int  takeRequest( Request &r ); // 1 - taken: must be answered by reply(), 0 - withdrawn
+   void reply( uint64_t seq, const std::string &s ); // from loop: answer to request seq
+   void setStatus( const std::string &s );           // answer to "get"
+   static int parseSet( const std::string &args, Request &r ); // 1 - ok
+  protected:
+   std::string sock_fn;
+   int sock_fd = -1;
+   std::thread th;
+   std::atomic<bool> req_pending { false }, stop_req { false }, quit { false };
+   Request req;
+   uint64_t seq = 0; // last request; late replies to timed out ones are dropped
+   bool req_taken = false; // loop applies it: no timeout, reply comes
+   std::mutex mtx;
+   std::condition_variable cv;
+   std::string rep, status;
+   bool rep_ready = false;
+
+   void run();
+   std::string command( const std::string &line );
+};
+
+#endif
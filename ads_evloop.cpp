@@ -0,0 +1,324 @@
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "ads_evloop.h"
+#include "ads_sched.h"
+
+using namespace std;
+
+FdOut::~FdOut()
+{
+  close();
+}
+
+// fd is set: check type, non-blocking for async pipe/tty/socket
+int FdOut::setup( bool a_async )
+{
+  struct stat sb;
+  if( fstat( fd, &sb ) != 0 ) {
+    return 0;
+  }
+  pollable = ! S_ISREG( sb.st_mode ) && ! S_ISBLK( sb.st_mode );
+  async = a_async;
+  if( async && pollable ) {
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+  }
+  return 1;
+}
+
+int FdOut::open( const string &a_fn, bool a_async )
+{
+  fn = a_fn;
+  fd = ::open( fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+  if( fd < 0 ) {
+    cerr << "Error: fail to open output file \"" << fn << "\": " << strerror( errno ) << endl;
+    return 0;
+  }
+  own = true;
+  return setup( a_async );
+}
+
+/*
+ *  name: FdOut::openStdout
+ *  function: screen output. For async pipe or tty stdout is opened again:
+ *            O_NONBLOCK of own file description does not touch the shell one.
+ *            Sockets and files stay on fd 1 (sockets: sync).
+ *  The return value: 1 - ok
+ */
+int FdOut::openStdout( bool a_async )
+{
+  fd = 1; own = false;
+  if( ! setup( false ) ) {
+    return 0;
+  }
+  if( a_async && pollable ) {
+    int fd2 = ::open( "/proc/self/fd/1", O_WRONLY | O_CLOEXEC );
+    if( fd2 >= 0 ) {
+      fd = fd2; own = true;
+    } else {
+      a_async = false;
+    }
+  }
+  return setup( a_async );
+}
+
+int FdOut::reopen()
+{
+  if( fn.empty() ) {
+    return 0;
+  }
+  lock_guard<mutex> lk( mtx );
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+  writeOut( true );
+  ::close( fd );
+  fd = ::open( fn.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666 );
+  if( fd < 0 ) {
+    cerr << "Error: fail to reopen output file \"" << fn << "\": " << strerror( errno ) << endl;
+    own = false;
+    return 0;
+  }
+  return setup( async );
+}
+
+void FdOut::close()
+{
+  if( fd < 0 ) {
+    return;
+  }
+  lock_guard<mutex> lk( mtx );
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK ); // the rest: wait
+  writeOut( true );
+  if( own ) {
+    ::close( fd );
+  }
+  fd = -1;
+}
+
+bool FdOut::hasPending()
+{
+  lock_guard<mutex> lk( mtx );
+  return buf.size() > off;
+}
+
+int FdOut::flush( bool force )
+{
+  lock_guard<mutex> lk( mtx );
+  return writeOut( force );
+}
+
+int FdOut::writeOut( bool force )
+{
+  if( fd < 0 || ( ! force && buf.size() - off < chunk ) ) {
+    return buf.size() == off;
+  }
+  while( off < buf.size() ) {
+    ssize_t w = ::write( fd, buf.data() + off, buf.size() - off );
+    if( w < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+      if( errno != EAGAIN ) {
+        cerr << "Error: output write: " << strerror( errno ) << endl;
+        dropped += buf.size() - off;
+        off = buf.size();
+      }
+      break;
+    }
+    off += w; written += w;
+  }
+  if( off == buf.size() ) {
+    buf.clear(); off = 0;
+    return 1;
+  }
+  if( off > ( 1u << 20 ) ) {
+    buf.erase( 0, off ); off = 0;
+  }
+  return 0;
+}
+
+streamsize FdOut::xsputn( const char *s, streamsize n )
+{
+  lock_guard<mutex> lk( mtx );
+  if( fd < 0 ) { // not opened: like closed ofstream
+    return n;
+  }
+  if( async && buf.size() - off + n > max_buf ) {
+    dropped += n;
+    return n;
+  }
+  buf.append( s, n );
+  if( ! async ) {
+    writeOut( false );
+  }
+  return n;
+}
+
+int FdOut::overflow( int c )
+{
+  if( c != traits_type::eof() ) {
+    const char ch = c;
+    xsputn( &ch, 1 );
+  }
+  return c;
+}
+
+int FdOut::sync()
+{
+  if( ! async ) {
+    lock_guard<mutex> lk( mtx );
+    writeOut( true );
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static const uint64_t ev_timer = ~0ull, ev_signal = ~1ull; // epoll data, else output index
+
+EvLoop::~EvLoop()
+{
+  for( int fd : { ep_fd, tm_fd, sig_fd } ) {
+    if( fd >= 0 ) {
+      close( fd );
+    }
+  }
+}
+
+/*
+ *  name: EvLoop::init
+ *  function: block signals, create epoll with signalfd and timerfd
+ *  The return value: 1 - ok, 0 - error
+ */
+int EvLoop::init()
+{
+  sigset_t ss;
+  sigemptyset( &ss );
+  for( int s : { SIGINT, SIGTERM, SIGHUP, SIGUSR1 } ) {
+    sigaddset( &ss, s );
+  }
+  pthread_sigmask( SIG_BLOCK, &ss, nullptr );
+  ep_fd  = epoll_create1( EPOLL_CLOEXEC );
+  sig_fd = signalfd( -1, &ss, SFD_NONBLOCK | SFD_CLOEXEC );
+  tm_fd  = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+  if( ep_fd < 0 || sig_fd < 0 || tm_fd < 0 ) {
+    cerr << "Error: fail to create event loop: " << strerror( errno ) << endl;
+    return 0;
+  }
+  epoll_event ev;
+  ev.events = EPOLLIN; ev.data.u64 = ev_signal;
+  epoll_ctl( ep_fd, EPOLL_CTL_ADD, sig_fd, &ev );
+  ev.events = EPOLLIN; ev.data.u64 = ev_timer;
+  epoll_ctl( ep_fd, EPOLL_CTL_ADD, tm_fd, &ev );
+  t_flush = mono_now_ns();
+  return 1;
+}
+
+void EvLoop::addOut( FdOut *o )
+{
+  outs.push_back( o );
+  out_watch.push_back( false );
+  if( o->isPollable() && o->getFd() >= 0 ) {
+    epoll_event ev;
+    ev.events = 0; ev.data.u64 = outs.size() - 1;
+    epoll_ctl( ep_fd, EPOLL_CTL_ADD, o->getFd(), &ev );
+  }
+}
+
+void EvLoop::readSignals()
+{
+  signalfd_siginfo si;
+  while( read( sig_fd, &si, sizeof(si) ) == sizeof(si) ) {
+    ++st.signals;
+    switch( si.ssi_signo ) {
+      case SIGHUP: // rotation now, statistics by loop
+        for( unsigned i=0; i<outs.size(); ++i ) {
+          if( outs[i]->reopen() && outs[i]->isPollable() ) { // new fd
+            epoll_event ev;
+            ev.events = 0; ev.data.u64 = i;
+            epoll_ctl( ep_fd, EPOLL_CTL_ADD, outs[i]->getFd(), &ev );
+            out_watch[i] = false;
+          }
+        }
+        ++n_hup;
+        break;
+      case SIGUSR1: ++n_usr1; break;
+      default:      ++n_stop; break;
+    }
+  }
+}
+
+// write what is possible, watch EPOLLOUT of outputs with the rest
+void EvLoop::serveOuts( bool force )
+{
+  for( unsigned i=0; i<outs.size(); ++i ) {
+    FdOut *o = outs[i];
+    o->flush( force );
+    const bool want = o->isPollable() && o->hasPending();
+    if( want != out_watch[i] && o->getFd() >= 0 ) {
+      epoll_event ev;
+      ev.events = want ? EPOLLOUT : 0; ev.data.u64 = i;
+      epoll_ctl( ep_fd, EPOLL_CTL_MOD, o->getFd(), &ev );
+      out_watch[i] = want;
+    }
+  }
+}
+
+void EvLoop::waitUntil( uint64_t t_ns )
+{
+  uint64_t now = mono_now_ns();
+  const bool do_wait = t_ns > now;
+  // long wait or old text: everything out now
+  const bool force = ( do_wait && t_ns - now > 10000000 ) || now - t_flush > 100000000;
+  if( force ) {
+    t_flush = now;
+  }
+  serveOuts( force );
+  if( do_wait ) {
+    itimerspec its;
+    memset( &its, 0, sizeof(its) );
+    its.it_value.tv_sec  = t_ns / 1000000000ull;
+    its.it_value.tv_nsec = t_ns % 1000000000ull;
+    timerfd_settime( tm_fd, TFD_TIMER_ABSTIME, &its, nullptr );
+  }
+
+  epoll_event evs[8];
+  bool done = false;
+  while( ! done && ! stopReq() ) {
+    ++st.waits;
+    int n = epoll_wait( ep_fd, evs, 8, do_wait ? -1 : 0 );
+    if( n < 0 && errno != EINTR ) {
+      break;
+    }
+    done = ! do_wait;
+    for( int k=0; k<n; ++k ) {
+      const uint64_t d = evs[k].data.u64;
+      if( d == ev_timer ) {
+        uint64_t exp;
+        if( read( tm_fd, &exp, sizeof(exp) ) > 0 ) {
+          ++st.timer;
+        }
+        done = true;
+      } else if( d == ev_signal ) {
+        readSignals();
+      } else if( d < outs.size() ) {
+        ++st.out_ready;
+        outs[d]->flush( true );
+      }
+    }
+    serveOuts( false );
+  }
+  if( do_wait && ! done ) { // stopped by signal
+    itimerspec its;
+    memset( &its, 0, sizeof(its) );
+    timerfd_settime( tm_fd, 0, &its, nullptr );
+  }
+}
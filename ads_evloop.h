@@ -0,0 +1,82 @@
+#ifndef _ADS_EVLOOP_H
+#define _ADS_EVLOOP_H
+
+#include <cstdint>
+#include <string>
+#include <streambuf>
+#include <mutex>
+#include <vector>
+
+// Output of text to fd (screen or -o file) for std::ostream.
+// async: text is collected and written, when fd takes it without blocking
+//        (by EvLoop: 8 KiB chunks, every 100 ms, at once before long waits);
+//        over max_buf new text is dropped, acquisition never waits for reader.
+// sync:  blocking writes by 8 KiB chunks and on flush (-j coordinator, -I, -Y).
+class FdOut : public std::streambuf {
+  public:
+   ~FdOut();
+   int  open( const std::string &a_fn, bool a_async ); // truncated, 1 - ok
+   int  openStdout( bool a_async );
+   int  reopen();                   // rotation: new file with the same name; 0 - not a file
+   int  flush( bool force = true ); // force: all, else only full chunk; 1 - nothing left
+   void close();
+   int  getFd() const { return fd; }
+   bool isPollable() const { return pollable; } // pipe, tty, socket: EPOLLOUT works
+   bool hasPending();
+   uint64_t getWritten() const { return written; }
+   uint64_t getDropped() const { return dropped; }
+   static const size_t chunk   = 8192;
+   static const size_t max_buf = 64 << 20;
+  protected:
+   std::string fn;
+   int  fd = -1;
+   bool own = false, async = false, pollable = false;
+   std::string buf;
+   size_t off = 0; // written part of buf
+   uint64_t written = 0, dropped = 0;
+   std::mutex mtx; // sync: coordinator writes, main thread rotates
+
+   virtual int overflow( int c ) override;
+   virtual std::streamsize xsputn( const char *s, std::streamsize n ) override;
+   virtual int sync() override;
+   int  setup( bool a_async );
+   int  writeOut( bool force ); // under mtx
+};
+
+// epoll of the main loop: timerfd for the line period, signalfd for
+// SIGINT/SIGTERM (stop), SIGHUP (rotate outputs, stats), SIGUSR1 (trace dump),
+// and outputs waiting for space (EPOLLOUT).
+// DRDY edges are not events here: scan is synchronous, see IoTransport::waitDrdy().
+// init() must be called before any thread start: signals are blocked
+// in every thread and taken only by signalfd.
+class EvLoop {
+  public:
+   struct Stats {
+     uint64_t waits   = 0; // epoll_wait calls
+     uint64_t timer   = 0; // deadlines
+     uint64_t signals = 0;
+     uint64_t out_ready = 0; // EPOLLOUT events
+   };
+   ~EvLoop();
+   int  init(); // 1 - ok
+   void addOut( FdOut *o );
+   // serve signals and outputs till deadline (CLOCK_MONOTONIC, ns) or stop signal;
+   // t_ns <= now: only take what is ready
+   void waitUntil( uint64_t t_ns );
+   bool stopReq() const { return n_stop > 0; }
+   bool takeHup()  { bool r = n_hup  > 0; n_hup  = 0; return r; }
+   bool takeUsr1() { bool r = n_usr1 > 0; n_usr1 = 0; return r; }
+   const Stats& getStats() const { return st; }
+  protected:
+   int ep_fd = -1, tm_fd = -1, sig_fd = -1;
+   std::vector<FdOut*> outs;
+   std::vector<bool> out_watch; // EPOLLOUT is set
+   unsigned n_stop = 0, n_hup = 0, n_usr1 = 0;
+   uint64_t t_flush = 0; // last full flush of outputs
+   Stats st;
+
+   void readSignals();
+   void serveOuts( bool force );
+};
+
+#endif
@@ -0,0 +1,464 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <linux/gpio.h>
+
+#include <bcm2835.h>
+
+#include "ads_io.h"
+
+using namespace std;
+
+extern "C" { // bcm_fake.c
+  void    bcm_fake_init(void);
+  uint8_t bcm_fake_spi_transfer( uint8_t value );
+  void    bcm_fake_gpio_write( uint8_t pin, uint8_t on );
+  uint8_t bcm_fake_gpio_lev( uint8_t pin );
+  void    bcm_fake_delay_us( uint64_t micros );
+}
+
+static inline uint64_t io_now_ns()
+{
+  timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/*
+ *  name: gpio_req_line
+ *  function: request one line of gpiochip (character device, v2 ABI)
+ *  The return value: line fd or -1
+ */
+static int gpio_req_line( const string &chip, uint8_t pin, uint64_t flags, int out_val, bool quiet )
+{
+  int chip_fd = ::open( chip.c_str(), O_RDWR | O_CLOEXEC );
+  if( chip_fd < 0 ) {
+    if( ! quiet ) {
+      cerr << "Error: fail to open \"" << chip << "\": " << strerror( errno ) << endl;
+    }
+    return -1;
+  }
+  gpio_v2_line_request req;
+  memset( &req, 0, sizeof(req) );
+  req.offsets[0] = pin;
+  req.num_lines = 1;
+  strncpy( req.consumer, "ads1256_da", sizeof(req.consumer) - 1 );
+  req.config.flags = flags;
+  if( out_val >= 0 ) {
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = out_val;
+    req.config.attrs[0].mask = 1;
+  }
+  const int rc = ioctl( chip_fd, GPIO_V2_GET_LINE_IOCTL, &req );
+  ::close( chip_fd );
+  if( rc < 0 ) {
+    if( ! quiet ) {
+      cerr << "Error: fail to request line " << (int)pin << " of " << chip << ": " << strerror( errno ) << endl;
+    }
+    return -1;
+  }
+  if( flags & GPIO_V2_LINE_FLAG_EDGE_FALLING ) { // events are drained before wait
+    fcntl( req.fd, F_SETFL, fcntl( req.fd, F_GETFL ) | O_NONBLOCK );
+  }
+  return req.fd;
+}
+
+/*
+ *  name: IoTransport::waitDrdy
+ *  function: old edges are dropped, then level is checked and, if high,
+ *            poll() sleeps for next falling edge: no CPU use while converting
+ *  The return value: 1 - DRDY low, 0 - timeout, -1 - caller must poll the level
+ */
+int IoTransport::waitDrdy( uint32_t us )
+{
+  if( edge_fd < 0 || us < edge_min_us ) {
+    return -1;
+  }
+  const uint64_t t_end = io_now_ns() + drdyTimeoutUs( us ) * 1000;
+  gpio_v2_line_event evs[16];
+  for( ;; ) {
+    while( read( edge_fd, evs, sizeof(evs) ) > 0 ) {
+      ++st.syscalls;
+    }
+    ++st.syscalls; // the last read: EAGAIN
+    if( gpioLev( pin_drdy ) == 0 ) {
+      return 1;
+    }
+    const uint64_t now = io_now_ns();
+    if( now >= t_end ) {
+      return 0;
+    }
+    pollfd pfd = { edge_fd, POLLIN, 0 };
+    ++st.syscalls; ++st.edge_waits;
+    poll( &pfd, 1, ( t_end - now + 999999 ) / 1000000 );
+  }
+}
+
+/*
+ *  name: IoTransport::xfer
+ *  function: generic batch: parts byte by byte, CS and delays by gpioWrite/delayUs
+ *  The return value: 1 - ok, 0 - error
+ */
+int IoTransport::xfer( const IoXfer *x, unsigned n )
+{
+  ++st.ops; ++st.batches;
+  gpioWrite( pin_cs, LOW );
+  for( unsigned k=0; k<n; ++k ) {
+    for( unsigned i=0; i<x[k].len; ++i ) {
+      const uint8_t r = spi( x[k].tx ? x[k].tx[i] : 0xFF );
+      if( x[k].rx ) {
+        x[k].rx[i] = r;
+      }
+    }
+    if( x[k].delay_us ) {
+      delayUs( x[k].delay_us );
+    }
+    if( x[k].cs_change && k+1 < n ) {
+      gpioWrite( pin_cs, HIGH );
+      gpioWrite( pin_cs, LOW );
+    }
+  }
+  gpioWrite( pin_cs, HIGH );
+  return 1;
+}
+
+/*
+ *  name: IoTransport::cmd
+ *  function: generic command: parts byte by byte with delays, CS is not touched
+ *  The return value: 1 - ok
+ */
+int IoTransport::cmd( const IoXfer *x, unsigned n )
+{
+  for( unsigned k=0; k<n; ++k ) {
+    for( unsigned i=0; i<x[k].len; ++i ) {
+      const uint8_t r = spi( x[k].tx ? x[k].tx[i] : 0xFF );
+      if( x[k].rx ) {
+        x[k].rx[i] = r;
+      }
+    }
+    if( x[k].delay_us ) {
+      delayUs( x[k].delay_us );
+    }
+  }
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+
+class IoBcm2835 : public IoTransport {
+  public:
+   virtual const char* name() const override { return "bcm2835"; }
+   virtual int  open() override;
+   virtual void close() override;
+   virtual uint8_t spi( uint8_t v ) override { ++st.ops; ++st.bytes; return bcm2835_spi_transfer( v ); }
+   virtual void gpioWrite( uint8_t pin, uint8_t on ) override { ++st.ops; bcm2835_gpio_write( pin, on ); }
+   virtual uint8_t gpioLev( uint8_t pin ) override { ++st.ops; return bcm2835_gpio_lev( pin ); }
+   virtual void delayUs( uint64_t us ) override;
+};
+
+void IoBcm2835::delayUs( uint64_t us )
+{
+#if defined(__arm__) || defined(BCM_FAKE)
+  bcm2835_delayMicroseconds( us );
+#else
+  usleep( us );
+#endif
+}
+
+int IoBcm2835::open()
+{
+  if( !bcm2835_init() ) {
+    return 0;
+  }
+  if( ! bcm2835_spi_begin() )  {
+    return 0;
+  }
+  // ADS1256 requires MSB first
+  bcm2835_spi_setBitOrder( BCM2835_SPI_BIT_ORDER_MSBFIRST );
+  bcm2835_spi_setDataMode( BCM2835_SPI_MODE1 );                  // The default = MODE1
+  bcm2835_spi_setClockDivider( BCM2835_SPI_CLOCK_DIVIDER_1024 ); // The default = 1024
+  bcm2835_gpio_fsel( pin_cs, BCM2835_GPIO_FSEL_OUTP );
+  bcm2835_gpio_fsel( pin_drdy, BCM2835_GPIO_FSEL_INPT );
+  bcm2835_gpio_set_pud( pin_drdy, BCM2835_GPIO_PUD_UP );
+  bcm2835_gpio_fsel( pin_rst, BCM2835_GPIO_FSEL_OUTP );
+#ifndef BCM_FAKE
+  // DRDY edges, if gpiochip is there; level is still read from registers
+  edge_fd = gpio_req_line( "/dev/gpiochip0", pin_drdy, GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING, -1, true );
+#endif
+  return 1;
+}
+
+void IoBcm2835::close()
+{
+  if( edge_fd >= 0 ) {
+    ::close( edge_fd ); edge_fd = -1;
+  }
+  bcm2835_spi_end();
+  bcm2835_close();
+}
+
+// ---------------------------------------------------------------------------
+
+class IoFake : public IoTransport {
+  public:
+   explicit IoFake( bool a_batch ) : batch( a_batch ) {}
+   virtual const char* name() const override { return batch ? "fake:batch" : "fake"; }
+   virtual int  open() override { bcm_fake_init(); return 1; }
+   virtual void close() override {}
+   virtual uint8_t spi( uint8_t v ) override { ++st.ops; ++st.bytes; return bcm_fake_spi_transfer( v ); }
+   virtual void gpioWrite( uint8_t pin, uint8_t on ) override { ++st.ops; bcm_fake_gpio_write( pin, on ); }
+   virtual uint8_t gpioLev( uint8_t pin ) override { ++st.ops; return bcm_fake_gpio_lev( pin ); }
+   virtual void delayUs( uint64_t us ) override { bcm_fake_delay_us( us ); }
+   virtual bool isBatched() const override { return batch; }
+  protected:
+   bool batch;
+};
+
+// ---------------------------------------------------------------------------
+
+// CS is the hardware CE of spidev: spi core sets it low for every message
+// and high at its end. The driver sends every command by cmd() as one message
+// (bytes and t6 delay of RREG/RDATA included), so CS "writes" are not needed:
+// CS may go high between commands. Single spi() bytes are messages of their own.
+class IoSpidev : public IoTransport {
+  public:
+   IoSpidev( const string &a_dev, uint32_t a_hz, const string &a_chip )
+     : dev( a_dev ), chip( a_chip ), hz( a_hz ), ff( max_part, 0xFF ) {}
+   virtual ~IoSpidev() { close(); }
+   virtual const char* name() const override { return "spidev"; }
+   virtual int  open() override;
+   virtual void close() override;
+   virtual uint8_t spi( uint8_t v ) override;
+   virtual void gpioWrite( uint8_t pin, uint8_t on ) override;
+   virtual uint8_t gpioLev( uint8_t pin ) override;
+   virtual void delayUs( uint64_t us ) override;
+   virtual int  xfer( const IoXfer *x, unsigned n ) override;
+   virtual int  cmd( const IoXfer *x, unsigned n ) override;
+   virtual bool isBatched() const override { return true; }
+  protected:
+   string dev, chip;
+   uint32_t hz;
+   int spi_fd = -1, rst_fd = -1; // DRDY: edge_fd
+   bool cs_low = false; // only for gpioLev()
+   uint8_t rst_lev = 1;
+   vector<uint8_t> ff; // tx for reads
+   vector<spi_ioc_transfer> tr;
+
+   int  message( unsigned n );
+   int  send( const IoXfer *x, unsigned n ); // parts in messages of max_tr transfers
+};
+
+/*
+ *  name: IoSpidev::open
+ *  function: SPI mode 1, 8 bits, MSB first; DRDY - input with pull-up and
+ *            falling edge events, RST - output high
+ *  The return value: 1 - ok, 0 - error
+ */
+int IoSpidev::open()
+{
+  cerr << "Warning: spidev transport is experimental (not tested on hardware), see -h" << endl;
+  spi_fd = ::open( dev.c_str(), O_RDWR | O_CLOEXEC );
+  if( spi_fd < 0 ) {
+    cerr << "Error: fail to open \"" << dev << "\": " << strerror( errno ) << endl;
+    return 0;
+  }
+  uint8_t mode = SPI_MODE_1, bits = 8;
+  if( ioctl( spi_fd, SPI_IOC_WR_MODE, &mode ) < 0 || ioctl( spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits ) < 0
+      || ioctl( spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz ) < 0 ) {
+    cerr << "Error: fail to set mode of \"" << dev << "\": " << strerror( errno ) << endl;
+    close();
+    return 0;
+  }
+
+  edge_fd = gpio_req_line( chip, pin_drdy,
+              GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_EDGE_FALLING, -1, false );
+  rst_fd  = gpio_req_line( chip, pin_rst, GPIO_V2_LINE_FLAG_OUTPUT, 1, false );
+  if( edge_fd < 0 || rst_fd < 0 ) {
+    close();
+    return 0;
+  }
+  return 1;
+}
+
+void IoSpidev::close()
+{
+  for( int *fd : { &spi_fd, &edge_fd, &rst_fd } ) {
+    if( *fd >= 0 ) {
+      ::close( *fd ); *fd = -1;
+    }
+  }
+}
+
+int IoSpidev::message( unsigned n )
+{
+  ++st.syscalls;
+  if( ioctl( spi_fd, SPI_IOC_MESSAGE( n ), tr.data() ) < 0 ) {
+    cerr << "Error: SPI_IOC_MESSAGE: " << strerror( errno ) << endl;
+    return 0;
+  }
+  return 1;
+}
+
+uint8_t IoSpidev::spi( uint8_t v )
+{
+  uint8_t r = 0xFF;
+  const IoXfer x = { &v, &r, 1, 0, 0 };
+  cmd( &x, 1 );
+  return r;
+}
+
+void IoSpidev::gpioWrite( uint8_t pin, uint8_t on )
+{
+  ++st.ops;
+  if( pin == pin_cs ) { // CS of every message is set by spi core
+    cs_low = ! on;
+    return;
+  }
+  if( pin == pin_rst ) {
+    gpio_v2_line_values lv = { (uint64_t)( on ? 1 : 0 ), 1 };
+    ++st.syscalls;
+    ioctl( rst_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv );
+    rst_lev = on;
+  }
+}
+
+uint8_t IoSpidev::gpioLev( uint8_t pin )
+{
+  ++st.ops;
+  if( pin == pin_cs ) {
+    return ! cs_low;
+  }
+  if( pin == pin_rst ) {
+    return rst_lev;
+  }
+  gpio_v2_line_values lv = { 0, 1 };
+  ++st.syscalls;
+  if( ioctl( edge_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv ) < 0 ) {
+    return HIGH;
+  }
+  return lv.bits & 1;
+}
+
+// short delays: spin on vDSO clock, no syscall
+void IoSpidev::delayUs( uint64_t us )
+{
+  timespec t0, t;
+  if( us >= 100 ) {
+    t.tv_sec = us / 1000000; t.tv_nsec = ( us % 1000000 ) * 1000;
+    ++st.syscalls;
+    clock_nanosleep( CLOCK_MONOTONIC, 0, &t, nullptr );
+    return;
+  }
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  const int64_t end = t0.tv_sec * 1000000000ll + t0.tv_nsec + us * 1000;
+  do {
+    clock_gettime( CLOCK_MONOTONIC, &t );
+  } while( t.tv_sec * 1000000000ll + t.tv_nsec < end );
+}
+
+int IoSpidev::xfer( const IoXfer *x, unsigned n )
+{
+  ++st.ops; ++st.batches;
+  return send( x, n );
+}
+
+int IoSpidev::cmd( const IoXfer *x, unsigned n )
+{
+  ++st.ops;
+  return send( x, n );
+}
+
+/*
+ *  name: IoSpidev::send
+ *  function: all parts in one SPI_IOC_MESSAGE ioctl, delays and CS by spi core
+ *            (over 511 parts: more ioctls, CS kept low between them by cs_change)
+ *  The return value: 1 - ok, 0 - error
+ */
+int IoSpidev::send( const IoXfer *x, unsigned n )
+{
+  static const unsigned max_tr = 511; // ioctl size field is 14 bits
+  for( unsigned k0 = 0; k0 < n; k0 += max_tr ) {
+    const unsigned m = min( n - k0, max_tr );
+    tr.assign( m, spi_ioc_transfer() );
+    for( unsigned k=0; k<m; ++k ) {
+      const IoXfer &p = x[k0+k];
+      if( p.len > max_part ) {
+        return 0;
+      }
+      tr[k].tx_buf = (uintptr_t)( p.tx ? p.tx : ff.data() );
+      tr[k].rx_buf = (uintptr_t)( p.rx );
+      tr[k].len = p.len;
+      tr[k].delay_usecs = p.delay_us;
+      tr[k].cs_change = p.cs_change;
+      st.bytes += p.len;
+    }
+    tr[m-1].cs_change = ( k0 + m < n ); // CS low between chunks, high at the end
+    if( ! message( m ) ) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+
+static IoBcm2835 io_bcm;
+static unique_ptr<IoTransport> io_own;
+IoTransport *io_tr = &io_bcm;
+
+/*
+ *  name: io_select
+ *  function: create transport by spec: bcm2835, spidev[:dev[:hz[:gpiochip]]], fake[:batch].
+ *            Default stays bcm2835: spidev is experimental (see ads_io.h).
+ *  The return value: 1 - ok, 0 - bad spec
+ */
+int io_select( const string &spec )
+{
+  vector<string> f;
+  for( size_t p = 0, e; ; p = e + 1 ) {
+    e = spec.find( ':', p );
+    f.push_back( spec.substr( p, e - p ) );
+    if( e == string::npos ) {
+      break;
+    }
+  }
+  if( f[0] == "bcm2835" && f.size() == 1 ) {
+    io_tr = &io_bcm;
+    return 1;
+  }
+  if( f[0] == "fake" && ( f.size() == 1 || ( f.size() == 2 && f[1] == "batch" ) ) ) {
+    io_own.reset( new IoFake( f.size() == 2 ) );
+    io_tr = io_own.get();
+    return 1;
+  }
+  if( f[0] == "spidev" && f.size() <= 4 ) {
+    const string dev  = ( f.size() > 1 && ! f[1].empty() ) ? f[1] : "/dev/spidev0.0";
+    uint32_t hz = 1000000; // ADS1256: SCLK up to fCLKIN/4 = 1.92 MHz
+    if( f.size() > 2 && ! f[2].empty() ) {
+      char *e;
+      hz = strtoul( f[2].c_str(), &e, 0 );
+      if( *e || hz < 1000 || hz > 1920000 ) {
+        cerr << "Error: bad SPI clock \"" << f[2] << "\", must be 1000..1920000 Hz" << endl;
+        return 0;
+      }
+    }
+    const string chip = ( f.size() > 3 && ! f[3].empty() ) ? f[3] : "/dev/gpiochip0";
+    io_own.reset( new IoSpidev( dev, hz, chip ) );
+    io_tr = io_own.get();
+    return 1;
+  }
+  cerr << "Error: bad transport \"" << spec << "\", must be bcm2835, spidev[:dev[:hz[:gpiochip]]] or fake[:batch]\n"
+       << "  spidev is experimental: not tested on hardware" << endl;
+  return 0;
+}
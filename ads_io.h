@@ -0,0 +1,71 @@
+#ifndef _ADS_IO_H
+#define _ADS_IO_H
+
+#include <cstdint>
+#include <string>
+
+// Transport of ADS1256 driver: SPI bytes, CS/RST writes, DRDY reads, delays.
+// Backends (-B):
+//   bcm2835                      - libbcm2835, memory mapped registers (root)
+//   spidev[:dev[:hz[:gpiochip]]] - Linux /dev/spidev0.0 + /dev/gpiochip0 (no root),
+//                                  every command in one SPI_IOC_MESSAGE ioctl with
+//                                  CS by spi core, whole scan in one ioctl.
+//                                  Experimental, never selected by default: not run
+//                                  on hardware yet
+//   fake[:batch]                 - ADS1256 model of bcm_fake.c in process,
+//                                  "batch" - scan by xfer() as with spidev
+// Pins are BCM GPIO numbers (= line offsets of gpiochip0 on Pi).
+
+struct IoXfer {        // part of batch, like struct spi_ioc_transfer
+  const uint8_t *tx;   // nullptr - send 0xFF
+  uint8_t *rx;         // nullptr - ignore input
+  uint16_t len;
+  uint16_t delay_us;   // after this part
+  uint8_t  cs_change;  // CS high between this part and the next one
+};
+
+class IoTransport {
+  public:
+   struct Stats {
+     uint64_t ops      = 0; // calls of spi, gpio and xfer
+     uint64_t syscalls = 0; // ioctl and sleep, memory mapped access is not counted
+     uint64_t bytes    = 0; // SPI bytes
+     uint64_t batches  = 0; // xfer() calls
+     uint64_t edge_waits = 0; // waitDrdy() sleeps
+   };
+   virtual ~IoTransport() = default;
+   virtual const char* name() const = 0;
+   virtual int  open() = 0; // 1 - ok
+   virtual void close() = 0;
+   virtual uint8_t spi( uint8_t v ) = 0;
+   virtual void gpioWrite( uint8_t pin, uint8_t on ) = 0;
+   virtual uint8_t gpioLev( uint8_t pin ) = 0;
+   virtual void delayUs( uint64_t us ) = 0;
+   // parts are sent under one CS low, CS is high at the end; default: byte by byte
+   virtual int  xfer( const IoXfer *x, unsigned n );
+   // one command (parts without CS change) under CS, written low by caller;
+   // default: byte by byte, CS transport: own CS low for this command only
+   virtual int  cmd( const IoXfer *x, unsigned n );
+   // true: xfer() is much cheaper than single bytes, scan should use it
+   virtual bool isBatched() const { return false; }
+   // sleep till DRDY falling edge: 1 - DRDY low, 0 - timeout (2*us + 1 ms, real time),
+   // -1 - no edge events or short wait: caller polls the level
+   int  waitDrdy( uint32_t us );
+   bool hasDrdyEdges() const { return edge_fd >= 0; }
+   void setPins( uint8_t a_cs, uint8_t a_drdy, uint8_t a_rst ) { pin_cs = a_cs; pin_drdy = a_drdy; pin_rst = a_rst; }
+   const Stats& getStats() const { return st; }
+   static const unsigned max_part = 4096; // bytes in one part
+   static const uint32_t edge_min_us = 1000; // shorter waits: polling reacts faster
+   // real time limit of DRDY wait for nominal us: settling after mux switch, clock tolerance
+   static uint64_t drdyTimeoutUs( uint32_t us ) { return 2ull * us + 1000; }
+  protected:
+   Stats st;
+   uint8_t pin_cs = 8, pin_drdy = 17, pin_rst = 18;
+   int edge_fd = -1; // gpiochip line of DRDY with falling edge events
+};
+
+extern IoTransport *io_tr; // never nullptr, default: bcm2835
+
+int io_select( const std::string &spec ); // create and set io_tr, 1 - ok
+
+#endif
@@ -0,0 +1,69 @@
+#include <cmath>
+
+#include "ads_out.h"
+#include "ads_telem.h"
+
+using namespace std;
+
+void fmt_line( ostream &s_os, double t, const vector<double> &v,
+               uint32_t i_n, bool do_dtime, double rdt, const vector<uint8_t> *gains )
+{
+  // s_os << setfill('0') << setw(8) << i_n << ' ' << showpoint  << setw(12) << setprecision(8) ;
+  s_os << showpoint  << setw(12) << setprecision(8);
+
+  s_os << t;
+
+  for( auto x : v ) {
+    if( std::isnan( x ) ) {
+      s_os << ( std::signbit( x ) ? " *" : " -" );
+    } else {
+      s_os << ' ' << DEF_PREC << x;
+    }
+  }
+
+  s_os << ' ' << setfill('0') << setw(8) << i_n;
+  if( do_dtime ) {
+    s_os << ' ' << rdt;
+  }
+  if( gains ) {
+    for( auto g : *gains ) {
+      if( g ) {
+        s_os << " x" << (unsigned)g;
+      } else {
+        s_os << " x-";
+      }
+    }
+  }
+  s_os << endl;
+}
+
+void out_str( ostringstream &s_os, int q_level, ostream &os, bool do_fout )
+{
+  if( q_level > 1 ) {
+    cout << '.';
+  } else {
+    cout << s_os.str();
+  };
+  if( do_fout ) {
+    os << s_os.str();
+    telem.addShared( Telemetry::OUT_BYTES, s_os.tellp() ); // -j: also coordinator
+  }
+  s_os.str(""); s_os.clear();
+}
+
+void LineOut::put( double t, const vector<double> &v, uint32_t i_n, double rdt,
+                   const vector<uint8_t> *gains )
+{
+  if( do_stat ) {
+    for( unsigned i=0; i<v.size(); ++i ) {
+      const double x = v[i];
+      if( ! std::isnan( x ) ) {
+        sums[i]  += x;
+        sums2[i] += x*x;
+        ++cnts[i];
+      }
+    }
+  }
+  fmt_line( s_os, t, v, i_n, do_dtime, rdt, gains );
+  out_str( s_os, q_level, os, do_fout );
+}
@@ -0,0 +1,42 @@
+#ifndef _ADS_OUT_H
+#define _ADS_OUT_H
+
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+#include <limits>
+
+// TODO param and function
+#define DEF_PREC std::setw(10) << std::setprecision(8)
+
+// NaN values: not measured in this line (multi-rate) - written as '-',
+// negative NaN - lost (DRDY timeout, stuck bus) - written as '*'
+const double v_lost = -std::numeric_limits<double>::quiet_NaN();
+inline bool is_lost( double x ) { return std::isnan( x ) && std::signbit( x ); }
+
+// one data line: time, values ('-', '*' or number),
+// line number [, time diff] [, x<gain> per value, "x-" - not measured]
+void fmt_line( std::ostream &s_os, double t, const std::vector<double> &v,
+               uint32_t i_n, bool do_dtime, double rdt,
+               const std::vector<uint8_t> *gains = nullptr );
+
+// move collected text to screen (or dot, if q_level > 1) and file
+void out_str( std::ostringstream &s_os, int q_level, std::ostream &os, bool do_fout );
+
+// line after measurement in acquisition loop without -j: statistics
+// (NaN values are not counted), fmt_line(), out_str(). The same for ads1256_bench.
+struct LineOut {
+  std::ostringstream &s_os;
+  std::ostream &os;
+  std::vector<double> &sums, &sums2;
+  std::vector<uint32_t> &cnts;
+  int  q_level;
+  bool do_fout, do_stat, do_dtime;
+  void put( double t, const std::vector<double> &v, uint32_t i_n, double rdt,
+            const std::vector<uint8_t> *gains = nullptr );
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include <iomanip>
+#include <cmath>
+
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "ads_pool.h"
+#include "ads_out.h"
+#include "ads_telem.h"
+
+using namespace std;
+
+static inline uint64_t mono_ns()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ------------------------------ WorkPool --------------------------------------
+
+WorkPool::WorkPool( unsigned n_workers, int a_acq_cpu )
+  : acq_cpu( a_acq_cpu ), t_start( mono_ns() )
+{
+  for( unsigned i=0; i<n_workers; ++i ) {
+    ws.emplace_back( new Worker );
+  }
+  for( unsigned i=0; i<n_workers; ++i ) {
+    ws[i]->th = thread( &WorkPool::loop, this, i );
+  }
+}
+
+WorkPool::~WorkPool()
+{
+  {
+    lock_guard<mutex> lk( mtx );
+    stop_req = true;
+  }
+  cv.notify_all();
+  for( auto &w : ws ) {
+    w->th.join();
+  }
+}
+
+void WorkPool::pinAway( int acq_cpu )
+{
+  const long n_cpu = sysconf( _SC_NPROCESSORS_ONLN );
+  if( acq_cpu < 0 || n_cpu < 2 ) {
+    return;
+  }
+  cpu_set_t cs;
+  CPU_ZERO( &cs );
+  for( long c=0; c<n_cpu; ++c ) {
+    if( c != acq_cpu ) {
+      CPU_SET( c, &cs );
+    }
+  }
+  sched_setaffinity( 0, sizeof(cs), &cs );
+}
+
+void WorkPool::run( vector<Task> &tasks )
+{
+  if( tasks.empty() ) {
+    return;
+  }
+  pending.store( tasks.size() );
+  {
+    lock_guard<mutex> lk( mtx );
+    queued += tasks.size(); // before push: popTask() may take a task at once
+  }
+  for( auto &t : tasks ) {
+    Worker &w = *ws[ rr++ % ws.size() ];
+    lock_guard<mutex> lk( w.mtx );
+    w.dq.push_back( move( t ) );
+  }
+  tasks.clear();
+  cv.notify_all();
+
+  unique_lock<mutex> lk( mtx );
+  cv_done.wait( lk, [this] { return pending.load() == 0; } );
+}
+
+bool WorkPool::popTask( unsigned self, Task &t, bool &stolen )
+{
+  {
+    Worker &w = *ws[self];
+    lock_guard<mutex> lk( w.mtx );
+    if( ! w.dq.empty() ) {
+      t = move( w.dq.back() ); w.dq.pop_back();
+      --queued; stolen = false;
+      return true;
+    }
+  }
+  for( unsigned i=1; i<ws.size(); ++i ) {
+    Worker &w = *ws[ ( self + i ) % ws.size() ];
+    lock_guard<mutex> lk( w.mtx );
+    if( ! w.dq.empty() ) {
+      t = move( w.dq.front() ); w.dq.pop_front();
+      --queued; stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkPool::loop( unsigned self )
+{
+  pinAway( acq_cpu );
+  Worker &w = *ws[self];
+  while( true ) {
+    Task t; bool stolen;
+    if( popTask( self, t, stolen ) ) {
+      const uint64_t t0 = mono_ns();
+      t();
+      w.busy_ns.fetch_add( mono_ns() - t0, memory_order_relaxed );
+      w.tasks.fetch_add( 1, memory_order_relaxed );
+      if( stolen ) {
+        w.steals.fetch_add( 1, memory_order_relaxed );
+      }
+      if( pending.fetch_sub( 1 ) == 1 ) {
+        lock_guard<mutex> lk( mtx );
+        cv_done.notify_all();
+      }
+      continue;
+    }
+    unique_lock<mutex> lk( mtx );
+    cv.wait( lk, [this] { return stop_req || queued.load() > 0; } );
+    if( stop_req && queued.load() == 0 ) {
+      return;
+    }
+  }
+}
+
+void WorkPool::report( ostream &os ) const
+{
+  const double t = ( mono_ns() - t_start ) * 1e-9;
+  const auto prec = os.precision();
+  os << "# pool: workers= " << ws.size() << " acq_cpu= " << acq_cpu << " t= " << t << endl;
+  for( unsigned i=0; i<ws.size(); ++i ) {
+    const Worker &w = *ws[i];
+    os << "#  w" << i << " busy= " << fixed << setprecision(2)
+       << ( t > 0 ? 100.0 * w.busy_ns.load() * 1e-9 / t : 0.0 ) << "%" << defaultfloat
+       << " tasks= " << w.tasks.load() << " steals= " << w.steals.load() << endl;
+  }
+  os.precision( prec );
+}
+
+// ------------------------------ LineProc --------------------------------------
+
+LineProc::LineProc( WorkPool &a_pool, int a_ch_n, vector<double> &a_sums, vector<double> &a_sums2,
+                    vector<uint32_t> &a_cnts, bool a_do_stat, bool a_do_dtime, int a_q_level, ostream &a_os, bool a_do_fout,
+                    unsigned a_block_lines, double a_flush_t )
+  : pool( a_pool ), ch_n( a_ch_n ), sums( a_sums ), sums2( a_sums2 ), cnts( a_cnts ),
+    do_stat( a_do_stat ), do_dtime( a_do_dtime ), q_level( a_q_level ), os( a_os ), do_fout( a_do_fout ),
+    block_lines( a_block_lines ), flush_t( a_flush_t ),
+    cols( a_ch_n ), col_offs( a_ch_n, vector<uint32_t>( a_block_lines + 1 ) )
+{
+  for( int c=0; c<ch_n; ++c ) {
+    col_os.emplace_back( new ostringstream );
+  }
+  cur.reset( new Block );
+}
+
+LineProc::~LineProc()
+{
+  stop();
+}
+
+void LineProc::start()
+{
+  stop_req = false; // may be restarted after stop(): reconfiguration
+  if( ! cur ) {
+    cur.reset( new Block );
+  }
+  cur->n = 0;
+  coord = thread( &LineProc::run, this );
+}
+
+void LineProc::push( double t, const vector<double> &v, uint32_t i_n, double rdt,
+                     const vector<uint8_t> *g )
+{
+  Block &b = *cur;
+  if( b.t.size() < block_lines ) { // only first use of block
+    b.t.resize( block_lines ); b.rdt.resize( block_lines ); b.idx.resize( block_lines );
+    b.v.resize( block_lines * ch_n );
+    if( do_gains ) {
+      b.g.resize( block_lines * ch_n ); b.gn.resize( block_lines );
+    }
+  }
+  b.t[b.n] = t; b.rdt[b.n] = rdt; b.idx[b.n] = i_n;
+  double *d = &b.v[ b.n * ch_n ];
+  for( int c=0; c<ch_n; ++c ) {
+    d[c] = v[c];
+  }
+  if( do_gains ) {
+    const unsigned gn = g ? min<size_t>( g->size(), ch_n ) : 0;
+    for( unsigned c=0; c<gn; ++c ) {
+      b.g[ b.n * ch_n + c ] = (*g)[c];
+    }
+    b.gn[b.n] = gn;
+  }
+  ++b.n;
+  if( b.n >= block_lines || t - b.t[0] >= flush_t ) {
+    handOver();
+  }
+}
+
+void LineProc::handOver()
+{
+  {
+    lock_guard<mutex> lk( mtx );
+    if( full.size() >= max_queue ) { // output can not keep up: acquisition never waits
+      dropped_lines += cur->n;
+      telem.add( Telemetry::POOL_DROPPED, cur->n );
+      cur->n = 0;
+      return;
+    }
+    full.push_back( move( cur ) );
+    telem.set( Telemetry::POOL_QUEUE, full.size() );
+    if( ! free_blocks.empty() ) {
+      cur = move( free_blocks.front() ); free_blocks.pop_front();
+    }
+  }
+  cv.notify_one();
+  if( ! cur ) {
+    cur.reset( new Block );
+  }
+  cur->n = 0;
+}
+
+void LineProc::stop()
+{
+  if( ! coord.joinable() ) {
+    return;
+  }
+  if( cur && cur->n > 0 ) {
+    handOver();
+  }
+  {
+    lock_guard<mutex> lk( mtx );
+    stop_req = true;
+  }
+  cv.notify_one();
+  coord.join();
+}
+
+void LineProc::run()
+{
+  WorkPool::pinAway( pool.getAcqCpu() );
+  while( true ) {
+    unique_ptr<Block> b;
+    {
+      unique_lock<mutex> lk( mtx );
+      cv.wait( lk, [this] { return stop_req || ! full.empty(); } );
+      if( full.empty() ) {
+        return;
+      }
+      b = move( full.front() ); full.pop_front();
+      telem.set( Telemetry::POOL_QUEUE, full.size() );
+    }
+    procBlock( *b );
+    lock_guard<mutex> lk( mtx );
+    free_blocks.push_back( move( b ) );
+  }
+}
+
+// statistics and formatting of one channel: in worker thread
+void LineProc::procChannel( const Block &b, int c )
+{
+  ostringstream &cs = *col_os[c];
+  string &col = cols[c];
+  vector<uint32_t> &offs = col_offs[c];
+  col.clear();
+  double s = sums[c], s2 = sums2[c]; // local copy: no false sharing, the same order of additions
+  uint32_t cn = cnts[c];
+  for( unsigned l=0; l<b.n; ++l ) {
+    const double x = b.v[ l * ch_n + c ];
+    offs[l] = col.size();
+    if( std::isnan( x ) ) { // not measured in this line or lost
+      col += std::signbit( x ) ? " *" : " -";
+      continue;
+    }
+    s += x; s2 += x*x; ++cn;
+    // the same as fmt_line(): fill is '0' after the first line
+    cs.str(""); cs.clear();
+    cs << showpoint << setfill( ( lines_done + l == 0 ) ? ' ' : '0' ) << ' ' << DEF_PREC << x;
+    col += cs.str();
+  }
+  offs[b.n] = col.size();
+  if( do_stat ) {
+    sums[c] = s; sums2[c] = s2; cnts[c] = cn;
+  }
+}
+
+void LineProc::procBlock( Block &b )
+{
+  for( int c=0; c<ch_n; ++c ) {
+    tasks.emplace_back( [this,&b,c] { procChannel( b, c ); } );
+  }
+  pool.run( tasks );
+
+  for( unsigned l=0; l<b.n; ++l ) { // ordered output
+    s_os << showpoint << setw(12) << setprecision(8) << b.t[l];
+    for( int c=0; c<ch_n; ++c ) {
+      s_os.write( cols[c].data() + col_offs[c][l], col_offs[c][l+1] - col_offs[c][l] );
+    }
+    s_os << ' ' << setfill('0') << setw(8) << b.idx[l];
+    if( do_dtime ) {
+      s_os << ' ' << b.rdt[l];
+    }
+    if( do_gains ) { // the same as fmt_line()
+      for( unsigned c=0; c<b.gn[l]; ++c ) {
+        if( b.g[ l * ch_n + c ] ) {
+          s_os << " x" << (unsigned)( b.g[ l * ch_n + c ] );
+        } else {
+          s_os << " x-";
+        }
+      }
+    }
+    s_os << endl;
+    out_str( s_os, q_level, os, do_fout );
+  }
+  lines_done += b.n;
+  ++blocks;
+}
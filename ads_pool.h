@@ -0,0 +1,109 @@
+#ifndef _ADS_POOL_H
+#define _ADS_POOL_H
+
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Small work-stealing thread pool: every worker has own deque, takes tasks
+// from back of own one, steals from front of others.
+// Workers are not allowed on CPU of acquisition thread.
+class WorkPool {
+  public:
+   using Task = std::function<void()>;
+   WorkPool( unsigned n_workers, int acq_cpu );
+   ~WorkPool();
+   void run( std::vector<Task> &tasks ); // execute all tasks, wait for them
+   unsigned size() const { return ws.size(); }
+   int getAcqCpu() const { return acq_cpu; }
+   void report( std::ostream &os ) const; // per-worker utilization
+   static void pinAway( int acq_cpu );    // current thread: all CPUs but acq_cpu
+  protected:
+   struct Worker {
+     std::mutex mtx;
+     std::deque<Task> dq;
+     std::thread th;
+     std::atomic<uint64_t> busy_ns { 0 }, tasks { 0 }, steals { 0 };
+   };
+   std::vector<std::unique_ptr<Worker>> ws;
+   int acq_cpu;
+   std::mutex mtx;
+   std::condition_variable cv, cv_done;
+   std::atomic<unsigned> queued { 0 }, pending { 0 };
+   bool stop_req = false;
+   uint64_t t_start;
+   unsigned rr = 0; // round-robin for new tasks
+
+   bool popTask( unsigned self, Task &t, bool &stolen );
+   void loop( unsigned self );
+};
+
+// Processing of lines after measureLine(): statistics and formatting are
+// done in blocks of lines, split by channel over WorkPool; lines are
+// assembled and written in order by coordinator thread.
+// Over max_queue blocks waiting (slow output) new blocks are dropped and counted.
+class LineProc {
+  public:
+   LineProc( WorkPool &a_pool, int a_ch_n, std::vector<double> &a_sums, std::vector<double> &a_sums2,
+             std::vector<uint32_t> &a_cnts, bool a_do_stat, bool a_do_dtime, int a_q_level, std::ostream &a_os, bool a_do_fout,
+             unsigned a_block_lines = 256, double a_flush_t = 0.5 );
+   ~LineProc();
+   void start();
+   void push( double t, const std::vector<double> &v, uint32_t i_n, double rdt,
+              const std::vector<uint8_t> *g = nullptr ); // acquisition thread
+   void setGains( bool g ) { do_gains = g; } // before start(): push() gets gains
+   void setLinesDone( uint64_t n ) // before start(): continue output of other LineProc
+     { lines_done = n; if( n > 0 ) { s_os.fill( '0' ); } }
+   void stop(); // process all, join
+   uint64_t getBlocks() const { return blocks; }
+   uint64_t getDroppedLines() const { return dropped_lines; } // acquisition thread
+   static const unsigned max_queue = 64;
+  protected:
+   struct Block {
+     unsigned n = 0;
+     std::vector<double> t, rdt, v; // v: n * ch_n
+     std::vector<uint32_t> idx;
+     std::vector<uint8_t> g;  // n * ch_n, if do_gains
+     std::vector<uint8_t> gn; // number of gains in line
+   };
+   WorkPool &pool;
+   int ch_n;
+   std::vector<double> &sums, &sums2;
+   std::vector<uint32_t> &cnts; // not NaN values
+   bool do_stat, do_dtime, do_gains = false;
+   int q_level;
+   std::ostream &os;
+   bool do_fout;
+   unsigned block_lines;
+   double flush_t;
+   std::unique_ptr<Block> cur;
+   std::deque<std::unique_ptr<Block>> full, free_blocks;
+   std::mutex mtx;
+   std::condition_variable cv;
+   bool stop_req = false;
+   std::thread coord;
+   uint64_t lines_done = 0, blocks = 0;
+   uint64_t dropped_lines = 0;
+   // per channel formatted columns
+   std::vector<std::string> cols;
+   std::vector<std::vector<uint32_t>> col_offs;
+   std::vector<std::unique_ptr<std::ostringstream>> col_os;
+   std::ostringstream s_os;
+   std::vector<WorkPool::Task> tasks;
+
+   void handOver();
+   void run();
+   void procBlock( Block &b );
+   void procChannel( const Block &b, int c );
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+
+#include <stdio.h>
+
+#include "ads_psd.h"
+
+using namespace std;
+
+// ------------------------------ RealFFT ---------------------------------------
+
+RealFFT::RealFFT( unsigned a_n )
+  : n( a_n ), h( a_n / 2 ), zr( h ), zi( h ), wr( h+1 ), wi( h+1 ), rev( h )
+{
+  unsigned lg = 0;
+  while( ( 1u << lg ) < h ) {
+    ++lg;
+  }
+  for( unsigned i=0; i<h; ++i ) {
+    unsigned r = 0;
+    for( unsigned b=0; b<lg; ++b ) {
+      r |= ( ( i >> b ) & 1 ) << ( lg - 1 - b );
+    }
+    rev[i] = r;
+  }
+  // stage with half-size m: twiddles exp(-2 pi i j / (2m)), j < m
+  for( unsigned m = 1; m < h; m *= 2 ) {
+    for( unsigned j=0; j<m; ++j ) {
+      twr.push_back(  cos( M_PI * j / m ) );
+      twi.push_back( -sin( M_PI * j / m ) );
+    }
+  }
+  for( unsigned k=0; k<=h; ++k ) {
+    wr[k] =  cos( 2 * M_PI * k / n );
+    wi[k] = -sin( 2 * M_PI * k / n );
+  }
+}
+
+void RealFFT::fft()
+{
+  double *xr = zr.data(), *xi = zi.data();
+  const double *tr = twr.data(), *ti = twi.data();
+  for( unsigned m = 1; m < h; m *= 2 ) {
+    for( unsigned b = 0; b < h; b += 2*m ) {
+      double *ar = xr + b, *ai = xi + b, *br = xr + b + m, *bi = xi + b + m;
+      for( unsigned j=0; j<m; ++j ) { // vectorizable: contiguous data and twiddles
+        const double tr_ = br[j] * tr[j] - bi[j] * ti[j];
+        const double ti_ = br[j] * ti[j] + bi[j] * tr[j];
+        br[j] = ar[j] - tr_;  bi[j] = ai[j] - ti_;
+        ar[j] += tr_;         ai[j] += ti_;
+      }
+    }
+    tr += m; ti += m;
+  }
+}
+
+void RealFFT::power( const double *x, double *p )
+{
+  for( unsigned i=0; i<h; ++i ) { // pack even/odd samples, bit reverse
+    zr[ rev[i] ] = x[2*i];
+    zi[ rev[i] ] = x[2*i+1];
+  }
+  fft();
+  for( unsigned k=0; k<=h; ++k ) {
+    const unsigned k1 = ( k == h ) ? 0 : k, k2 = ( k == 0 ) ? 0 : ( h - k );
+    const double ar = zr[k1], ai = zi[k1], br = zr[k2], bi = -zi[k2]; // A = Z[k], B = conj(Z[h-k])
+    const double er = 0.5 * ( ar + br ), ei = 0.5 * ( ai + bi );    // E = (A+B)/2
+    const double or_ = 0.5 * ( ai - bi ), oi = -0.5 * ( ar - br );  // O = (A-B)/(2i)
+    const double xr = er + wr[k] * or_ - wi[k] * oi;
+    const double xi = ei + wr[k] * oi  + wi[k] * or_;
+    p[k] = xr * xr + xi * xi;
+  }
+}
+
+// ------------------------------ WelchPSD --------------------------------------
+
+WelchPSD::WelchPSD( unsigned a_nfft, int a_ch_n, double a_fs, unsigned a_q_lines )
+  : nfft( a_nfft ), hop( a_nfft / 2 ), ch_n( a_ch_n ), fs( a_fs ),
+    q( (size_t)(a_q_lines) * a_ch_n ), q_lines( a_q_lines ),
+    fft( a_nfft ), win( a_nfft ), seg( a_ch_n, vector<double>( a_nfft ) ),
+    xw( a_nfft ), pw( a_nfft/2 + 1 ), psd_sum( a_ch_n, vector<double>( a_nfft/2 + 1, 0.0 ) ),
+    ch_segs( a_ch_n, 0 )
+{
+  for( unsigned i=0; i<nfft; ++i ) { // periodic Hann
+    win[i] = 0.5 - 0.5 * cos( 2 * M_PI * i / nfft );
+    win_s2 += win[i] * win[i];
+  }
+  band_f2 = fs / 2;
+}
+
+WelchPSD::~WelchPSD()
+{
+  stop();
+}
+
+int WelchPSD::start()
+{
+  stop_req = false;
+  worker = thread( &WelchPSD::run, this );
+  return 1;
+}
+
+void WelchPSD::stop()
+{
+  if( ! worker.joinable() ) {
+    return;
+  }
+  stop_req.store( true, memory_order_release );
+  worker.join();
+  if( ! out_fn.empty() ) {
+    writeSpectrum( out_fn );
+  }
+}
+
+bool WelchPSD::push( const vector<double> &v )
+{
+  const uint64_t hd = q_head.load( memory_order_relaxed );
+  if( hd - q_tail.load( memory_order_acquire ) >= q_lines ) {
+    dropped.fetch_add( 1, memory_order_relaxed );
+    return false;
+  }
+  double *d = &q[ ( hd % q_lines ) * ch_n ];
+  for( int i=0; i<ch_n; ++i ) {
+    d[i] = v[i];
+  }
+  q_head.store( hd + 1, memory_order_release );
+  return true;
+}
+
+void WelchPSD::run()
+{
+  uint64_t segs_written = 0;
+  while( true ) {
+    const uint64_t hd = q_head.load( memory_order_acquire );
+    uint64_t tl = q_tail.load( memory_order_relaxed );
+    if( tl == hd ) {
+      if( stop_req.load( memory_order_acquire ) && q_head.load( memory_order_acquire ) == tl ) {
+        break;
+      }
+      this_thread::sleep_for( chrono::milliseconds( 2 ) );
+      continue;
+    }
+    for( ; tl != hd; ++tl ) {
+      addLine( &q[ ( tl % q_lines ) * ch_n ] );
+      q_tail.store( tl + 1, memory_order_release );
+    }
+    if( ! out_fn.empty() && segs >= segs_written + write_every ) {
+      writeSpectrum( out_fn );
+      segs_written = segs;
+    }
+  }
+}
+
+void WelchPSD::addLine( const double *v )
+{
+  for( int c=0; c<ch_n; ++c ) {
+    seg[c][seg_fill] = v[c];
+  }
+  if( ++seg_fill < nfft ) {
+    return;
+  }
+  procSegs();
+  for( int c=0; c<ch_n; ++c ) { // 50% overlap
+    memmove( seg[c].data(), seg[c].data() + hop, ( nfft - hop ) * sizeof(double) );
+  }
+  seg_fill = nfft - hop;
+}
+
+void WelchPSD::procSegs()
+{
+  const unsigned nb = nfft/2 + 1;
+  for( int c=0; c<ch_n; ++c ) {
+    const double *x = seg[c].data();
+    double mean = 0;
+    for( unsigned i=0; i<nfft; ++i ) {
+      mean += x[i];
+    }
+    if( std::isnan( mean ) ) { // lost value: one NaN would spoil the sum forever
+      ++lost_segs;
+      continue;
+    }
+    mean /= nfft;
+    for( unsigned i=0; i<nfft; ++i ) {
+      xw[i] = ( x[i] - mean ) * win[i];
+    }
+    fft.power( xw.data(), pw.data() );
+    double *s = psd_sum[c].data();
+    for( unsigned k=0; k<nb; ++k ) {
+      s[k] += pw[k];
+    }
+    ++ch_segs[c];
+  }
+  ++segs;
+}
+
+// one-sided PSD, V^2/Hz
+double WelchPSD::psdAt( int ch, unsigned k ) const
+{
+  const uint64_t n = ch_segs[ch];
+  if( n == 0 ) {
+    return 0;
+  }
+  double v = psd_sum[ch][k] / ( n * fs * win_s2 );
+  if( k != 0 && k != nfft/2 ) {
+    v *= 2;
+  }
+  return v;
+}
+
+int WelchPSD::setBand( double f1, double f2 )
+{
+  if( ! ( f1 >= 0 && f1 < f2 && f2 <= fs / 2 ) ) {
+    return 0;
+  }
+  band_f1 = f1; band_f2 = f2;
+  return 1;
+}
+
+unsigned WelchPSD::binOf( double f ) const
+{
+  double k = f * nfft / fs;
+  if( k < 0 ) {
+    return 0;
+  }
+  if( k > nfft/2 ) {
+    return nfft/2;
+  }
+  return (unsigned)( k + 0.5 );
+}
+
+double WelchPSD::noiseDensity( int ch ) const
+{
+  const unsigned k1 = binOf( band_f1 ), k2 = binOf( band_f2 );
+  double s = 0;
+  for( unsigned k=k1; k<=k2; ++k ) {
+    s += psdAt( ch, k );
+  }
+  return sqrt( s / ( k2 - k1 + 1 ) );
+}
+
+double WelchPSD::bandRms( int ch ) const
+{
+  const unsigned k1 = binOf( band_f1 ), k2 = binOf( band_f2 );
+  double s = 0;
+  for( unsigned k=k1; k<=k2; ++k ) {
+    s += psdAt( ch, k );
+  }
+  return sqrt( s * fs / nfft );
+}
+
+/*
+ *  name: WelchPSD::writeSpectrum
+ *  function: write averaged spectrum: "f psd_0 ... psd_n-1", V^2/Hz.
+ *            File is replaced atomically (tmp + rename).
+ *  The return value: 1 - ok, 0 - error
+ */
+int WelchPSD::writeSpectrum( const string &fn ) const
+{
+  const string tmp_fn = fn + ".tmp";
+  ofstream os( tmp_fn );
+  if( ! os ) {
+    cerr << "Error: fail to open PSD file \"" << tmp_fn << "\"" << endl;
+    return 0;
+  }
+  os << "# PSD Welch nfft= " << nfft << " fs= " << fs << " segs= " << segs
+     << " dropped= " << getDropped() << " lost_segs= " << lost_segs << endl;
+  os << "# f, Hz; PSD, V^2/Hz" << endl;
+  os << setprecision( 8 );
+  for( unsigned k=0; k<=nfft/2; ++k ) {
+    os << ( k * fs / nfft );
+    for( int c=0; c<ch_n; ++c ) {
+      os << ' ' << psdAt( c, k );
+    }
+    os << '\n';
+  }
+  os << "## noise density [" << band_f1 << ',' << band_f2 << "] Hz, V/sqrt(Hz):" << endl << '#';
+  for( int c=0; c<ch_n; ++c ) {
+    os << ' ' << noiseDensity( c );
+  }
+  os << endl;
+  os.close();
+  if( rename( tmp_fn.c_str(), fn.c_str() ) != 0 ) {
+    cerr << "Error: fail to rename PSD file \"" << tmp_fn << "\"" << endl;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,82 @@
+#ifndef _ADS_PSD_H
+#define _ADS_PSD_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+// Power of |FFT|^2 of real data: n real -> n/2 complex FFT + split.
+// Data in separate re/im arrays, so inner loops can be vectorized.
+class RealFFT {
+  public:
+   explicit RealFFT( unsigned a_n ); // a_n: power of 2, >= 4
+   unsigned size() const { return n; }
+   void power( const double *x, double *p ); // p[0..n/2] = |X_k|^2
+  protected:
+   unsigned n, h;                // h = n/2 - complex FFT size
+   std::vector<double> zr, zi;   // work
+   std::vector<double> twr, twi; // twiddles for all stages, contiguous
+   std::vector<double> wr, wi;   // exp(-2 pi i k/n), k <= h
+   std::vector<unsigned> rev;    // bit reverse for h
+   void fft();
+};
+
+// Welch PSD for all channels: Hann window, 50% overlap, mean removed.
+// Segment of a channel with lost values (NaN) is skipped and counted.
+// Lines are pushed by acquisition loop to lock-free ring, processed in worker thread.
+class WelchPSD {
+  public:
+   WelchPSD( unsigned a_nfft, int a_ch_n, double a_fs, unsigned a_q_lines = 4096 );
+   ~WelchPSD();
+   int  setBand( double f1, double f2 ); // 0 <= f1 < f2 <= fs/2; 1 - ok
+   void setOutFile( const std::string &fn, unsigned every = 16 ) { out_fn = fn; write_every = every; }
+   int  start();
+   void stop(); // process queued lines, join worker
+   bool push( const std::vector<double> &v ); // from acquisition loop, never blocks
+   uint64_t getSegs() const { return segs; }
+   uint64_t getLostSegs() const { return lost_segs; } // channel segments with NaN
+   uint64_t getDropped() const { return dropped.load( std::memory_order_relaxed ); }
+   uint64_t queueDepth() const // lines
+     { return q_head.load( std::memory_order_relaxed ) - q_tail.load( std::memory_order_relaxed ); }
+   double getFs() const { return fs; }
+   double getBandF1() const { return band_f1; }
+   double getBandF2() const { return band_f2; }
+   double noiseDensity( int ch ) const; // V/sqrt(Hz), mean PSD in band
+   double bandRms( int ch ) const;      // V, integrated PSD in band
+   int  writeSpectrum( const std::string &fn ) const;
+  protected:
+   unsigned nfft, hop;
+   int ch_n;
+   double fs;
+   double band_f1 = 0, band_f2 = 0;
+   std::string out_fn;
+   unsigned write_every = 16;
+   // queue: q_lines * ch_n values
+   std::vector<double> q;
+   unsigned q_lines;
+   std::atomic<uint64_t> q_head { 0 }, q_tail { 0 };
+   std::atomic<uint64_t> dropped { 0 };
+   std::atomic<bool> stop_req { false };
+   std::thread worker;
+   // worker data
+   RealFFT fft;
+   std::vector<double> win;
+   double win_s2 = 0; // sum of win^2
+   std::vector<std::vector<double>> seg; // per channel
+   unsigned seg_fill = 0;
+   std::vector<double> xw, pw;
+   std::vector<std::vector<double>> psd_sum; // per channel, nfft/2+1
+   uint64_t segs = 0;
+   std::vector<uint64_t> ch_segs; // averaged segments of channel
+   uint64_t lost_segs = 0;
+
+   void run();
+   void addLine( const double *v );
+   void procSegs();
+   double psdAt( int ch, unsigned k ) const;
+   unsigned binOf( double f ) const;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <time.h>
+
+#include "ads_sched.h"
+
+using namespace std;
+
+uint64_t mono_now_ns()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ------------------------------ LatHist ---------------------------------------
+
+unsigned LatHist::idx( uint64_t v )
+{
+  if( v < ( 1u << sub_bits ) ) {
+    return v;
+  }
+  const unsigned msb = 63 - __builtin_clzll( v );
+  const unsigned sub = ( v >> ( msb - sub_bits ) ) & ( ( 1u << sub_bits ) - 1 );
+  return ( ( msb - sub_bits + 1 ) << sub_bits ) + sub;
+}
+
+uint64_t LatHist::upper( unsigned i )
+{
+  if( i < ( 1u << sub_bits ) ) {
+    return i;
+  }
+  const unsigned msb = ( i >> sub_bits ) + sub_bits - 1;
+  const uint64_t sub = i & ( ( 1u << sub_bits ) - 1 );
+  return ( ( ( 1ull << sub_bits ) + sub + 1 ) << ( msb - sub_bits ) ) - 1;
+}
+
+void LatHist::add( uint64_t v )
+{
+  ++buck[ idx( v ) ];
+  ++n; v_sum += v;
+  if( v > v_max ) {
+    v_max = v;
+  }
+}
+
+uint64_t LatHist::percentile( double q ) const
+{
+  if( n == 0 ) {
+    return 0;
+  }
+  uint64_t need = (uint64_t)( q * n );
+  if( need >= n ) {
+    need = n - 1;
+  }
+  uint64_t acc = 0;
+  for( unsigned i=0; i<n_buck; ++i ) {
+    acc += buck[i];
+    if( acc > need ) {
+      const uint64_t u = upper( i );
+      return ( u < v_max ) ? u : v_max;
+    }
+  }
+  return v_max;
+}
+
+void LatHist::clear()
+{
+  memset( buck, 0, sizeof(buck) );
+  n = 0; v_max = 0; v_sum = 0;
+}
+
+// ------------------------------ PeriodicSched ---------------------------------
+
+static const char* const policy_names[PeriodicSched::POL_NUM] = { "catchup", "skip", "stretch" };
+
+PeriodicSched::Policy PeriodicSched::findPolicy( const char *s )
+{
+  for( unsigned i=0; i<POL_NUM; ++i ) {
+    if( strcmp( s, policy_names[i] ) == 0 ) {
+      return (Policy)(i);
+    }
+  }
+  return POL_NUM;
+}
+
+const char* PeriodicSched::policyName( Policy p )
+{
+  return ( p < POL_NUM ) ? policy_names[p] : "?";
+}
+
+int PeriodicSched::parsePeriod( const char *s, uint64_t &ns )
+{
+  char *e;
+  double v = strtod( s, &e );
+  if( e == s || ! ( v >= 0 ) ) {
+    return 0;
+  }
+  if( strcmp( e, "us" ) == 0 ) {
+    ns = (uint64_t)( v * 1e3 + 0.5 );
+    return 1;
+  }
+  if( *e != '\0' && strcmp( e, "ms" ) != 0 ) {
+    return 0;
+  }
+  ns = (uint64_t)( v * 1e6 + 0.5 );
+  return 1;
+}
+
+void PeriodicSched::start( uint64_t t0_ns )
+{
+  t_start = t0 = deadline = t0_ns;
+  tick = 0; late = 0;
+  missed = skipped = stretched = 0;
+  hist.clear();
+  hist.add( 0 );
+}
+
+/*
+ *  name: PeriodicSched::advance
+ *  function: go to next tick, apply policy to overrun. Waiting is up to caller
+ *            (event loop), then wake() must be called.
+ *  The return value: deadline of new tick, ns
+ */
+uint64_t PeriodicSched::advance()
+{
+  ++tick;
+  uint64_t now = mono_now_ns();
+  if( period == 0 ) { // free running
+    deadline = now;
+    return deadline;
+  }
+  deadline = t0 + tick * period;
+  if( now > deadline ) { // previous line was too long
+    ++missed;
+    if( pol == POL_SKIP ) {
+      const uint64_t n = ( now - deadline ) / period + 1;
+      tick += n; skipped += n;
+      deadline += n * period;
+    } else if( pol == POL_STRETCH ) {
+      stretched += now - deadline;
+      t0 += now - deadline;
+      deadline = now;
+    }
+  }
+  return deadline;
+}
+
+void PeriodicSched::wake( uint64_t now )
+{
+  late = (int64_t)( now - deadline );
+  hist.add( late > 0 ? late : 0 );
+}
+
+void PeriodicSched::report( ostream &os ) const
+{
+  os << "# sched: period_ns= " << period << " policy= " << policyName( pol )
+     << " ticks= " << tick + 1 << " missed= " << missed << " skipped= " << skipped
+     << " stretched_ms= " << stretched * 1e-6
+     << " late_us: p50= " << hist.percentile( 0.5 ) * 1e-3
+     << " p99= " << hist.percentile( 0.99 ) * 1e-3
+     << " p999= " << hist.percentile( 0.999 ) * 1e-3
+     << " max= " << hist.getMax() * 1e-3 << endl;
+}
@@ -0,0 +1,63 @@
+#ifndef _ADS_SCHED_H
+#define _ADS_SCHED_H
+
+#include <cstdint>
+#include <iostream>
+
+// Histogram of non-negative ns values: log2 buckets, each split to 8 linear ones.
+class LatHist {
+  public:
+   static const unsigned sub_bits = 3;
+   static const unsigned n_buck = 64 << sub_bits;
+   void add( uint64_t v );
+   uint64_t percentile( double q ) const; // upper bound of bucket, ns
+   uint64_t getN() const { return n; }
+   uint64_t getMax() const { return v_max; }
+   uint64_t getSum() const { return v_sum; }
+   void clear();
+  protected:
+   uint64_t buck[n_buck] = { 0 };
+   uint64_t n = 0, v_max = 0, v_sum = 0;
+   static unsigned idx( uint64_t v );
+   static uint64_t upper( unsigned i );
+};
+
+// Drift-free periodic ticks: deadline of tick k is t_start + k * period, in ns.
+// Period 0: free running, every deadline is now, nothing is missed.
+// Policy on overrun (previous line finished after deadline):
+//   catch-up - run missed ticks without sleep;
+//   skip     - drop missed ticks, go to the next one in future;
+//   stretch  - move the whole schedule, tick starts now.
+class PeriodicSched {
+  public:
+   enum Policy { POL_CATCHUP = 0, POL_SKIP, POL_STRETCH, POL_NUM };
+   PeriodicSched( uint64_t a_period_ns, Policy a_pol ) : period( a_period_ns ), pol( a_pol ) {}
+   static Policy findPolicy( const char *s ); // POL_NUM - bad name
+   static const char* policyName( Policy p );
+   // ms, may be fractional or with "us" suffix; 0 - free running; 1 - ok
+   static int parsePeriod( const char *s, uint64_t &ns );
+   void start( uint64_t t0_ns );
+   uint64_t advance();          // next tick: its deadline, ns
+   void wake( uint64_t now );   // after wait for deadline: lateness
+   uint64_t getTick() const { return tick; }
+   double tickTime() const { return ( deadline - t_start ) * 1e-9; } // s from start
+   int64_t getLate() const { return late; }                         // ns, last wake - deadline
+   uint64_t getPeriod() const { return period; }
+   uint64_t getMissed() const { return missed; }
+   uint64_t getSkipped() const { return skipped; }
+   uint64_t getStretched() const { return stretched; }
+   const LatHist& getHist() const { return hist; }
+   void report( std::ostream &os ) const;
+  protected:
+   uint64_t period;
+   Policy pol;
+   uint64_t t_start = 0, t0 = 0; // t0 - moved by stretch
+   uint64_t tick = 0, deadline = 0;
+   int64_t late = 0;
+   uint64_t missed = 0, skipped = 0, stretched = 0; // stretched: ns
+   LatHist hist;
+};
+
+uint64_t mono_now_ns();
+
+#endif
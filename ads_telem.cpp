@@ -0,0 +1,191 @@
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ads_telem.h"
+
+using namespace std;
+
+Telemetry telem;
+
+const Telemetry::MetricInfo Telemetry::info[Telemetry::ID_NUM] = {
+//  id              name                        labels              type     help
+  { LINES,          "ads_lines_total",          "",                 COUNTER, "Lines acquired" },
+  { DRDY_TIMEOUTS,  "ads_drdy_timeouts_total",  "",                 COUNTER, "DRDY wait timeouts" },
+  { SCHED_MISSED,   "ads_sched_missed_total",   "",                 COUNTER, "Lines started after deadline (overruns)" },
+  { SCHED_SKIPPED,  "ads_sched_skipped_total",  "",                 COUNTER, "Periods dropped by skip policy" },
+  { LATE_P50,       "ads_late_seconds",         "quantile=\"0.5\"",   SUMMARY, "Line start lateness after deadline" },
+  { LATE_P99,       "ads_late_seconds",         "quantile=\"0.99\"",  SUMMARY, "" },
+  { LATE_P999,      "ads_late_seconds",         "quantile=\"0.999\"", SUMMARY, "" },
+  { LATE_SUM,       "ads_late_seconds_sum",     "",                 SUMMARY, "" },
+  { LATE_COUNT,     "ads_late_seconds_count",   "",                 SUMMARY, "" },
+  { LATE_MAX,       "ads_late_max_seconds",     "",                 GAUGE,   "Max line start lateness" },
+  { SPI_BYTES,      "ads_spi_bytes_total",      "",                 COUNTER, "Bytes transferred over SPI" },
+  { OUT_BYTES,      "ads_out_bytes_total",      "",                 COUNTER, "Bytes written to output file" },
+  { PSD_QUEUE,      "ads_psd_queue_lines",      "",                 GAUGE,   "Lines waiting in PSD queue" },
+  { PSD_DROPPED,    "ads_psd_dropped_total",    "",                 COUNTER, "Lines dropped by full PSD queue" },
+  { POOL_QUEUE,     "ads_pool_queue_blocks",    "",                 GAUGE,   "Blocks waiting for post-processing" },
+  { POOL_DROPPED,   "ads_pool_dropped_lines_total", "",             COUNTER, "Lines dropped by full post-processing queue" },
+  { GAIN_SWITCHES,  "ads_gain_switches_total",  "",                 COUNTER, "Auto-ranging gain changes" },
+  { SAMPLES_LOST,   "ads_samples_lost_total",   "",                 COUNTER, "Values lost by DRDY timeout or stuck bus" },
+  { RECOVERIES,     "ads_recoveries_total",     "",                 COUNTER, "Successful ADC recoveries" },
+  { RECOVER_FAILED, "ads_recover_failed_total", "",                 COUNTER, "Failed ADC recoveries" },
+  { START_TIME,     "ads_start_time_seconds",   "",                 GAUGE,   "Start time, unix epoch" }
+};
+
+Telemetry::Telemetry()
+{
+  for( unsigned i=0; i<ID_NUM; ++i ) {
+    cnt[i].store( 0, memory_order_relaxed );
+    gauge[i].store( 0.0, memory_order_relaxed );
+  }
+}
+
+Telemetry::~Telemetry()
+{
+  stop();
+}
+
+string Telemetry::text() const
+{
+  ostringstream s;
+  s.precision( 15 );
+  for( const auto &m : info ) {
+    if( *m.help ) { // new family: summary _sum and _count follow quantiles
+      static const char *tnames[] = { "counter", "gauge", "summary" };
+      s << "# HELP " << m.name << ' ' << m.help << '\n';
+      s << "# TYPE " << m.name << ' ' << tnames[m.type] << '\n';
+    }
+    s << m.name;
+    if( *m.labels ) {
+      s << '{' << m.labels << '}';
+    }
+    s << ' ';
+    if( m.type == COUNTER ) {
+      s << cnt[m.id].load( memory_order_relaxed );
+    } else {
+      s << gauge[m.id].load( memory_order_relaxed );
+    }
+    s << '\n';
+  }
+  return s.str();
+}
+
+/*
+ *  name: Telemetry::writeFile
+ *  function: write metrics for node exporter textfile collector.
+ *            File is replaced atomically (tmp + rename).
+ *  The return value: 1 - ok, 0 - error
+ */
+int Telemetry::writeFile() const
+{
+  const string tmp_fn = file_fn + ".tmp";
+  ofstream f( tmp_fn );
+  if( ! f ) {
+    cerr << "Error: fail to open telemetry file \"" << tmp_fn << "\"" << endl;
+    return 0;
+  }
+  f << text();
+  f.close();
+  if( rename( tmp_fn.c_str(), file_fn.c_str() ) != 0 ) {
+    cerr << "Error: fail to rename telemetry file \"" << tmp_fn << "\"" << endl;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ *  name: Telemetry::start
+ *  function: open Unix socket (if name is not empty) and start exporter thread
+ *  The return value: 1 - ok, 0 - error
+ */
+int Telemetry::start( const string &a_file_fn, const string &a_sock_fn, unsigned a_period_ms )
+{
+  file_fn = a_file_fn; sock_fn = a_sock_fn; period_ms = a_period_ms;
+  set( START_TIME, chrono::duration<double>( chrono::system_clock::now().time_since_epoch() ).count() );
+
+  if( ! sock_fn.empty() ) {
+    sockaddr_un sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sun_family = AF_UNIX;
+    if( sock_fn.size() >= sizeof(sa.sun_path) ) {
+      cerr << "Error: too long socket name \"" << sock_fn << "\"" << endl;
+      return 0;
+    }
+    strcpy( sa.sun_path, sock_fn.c_str() );
+    unlink( sock_fn.c_str() );
+    sock_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( sock_fd < 0 || bind( sock_fd, (sockaddr*)(&sa), sizeof(sa) ) != 0 || listen( sock_fd, 4 ) != 0 ) {
+      cerr << "Error: fail to listen on \"" << sock_fn << "\": " << strerror( errno ) << endl;
+      if( sock_fd >= 0 ) {
+        close( sock_fd ); sock_fd = -1;
+      }
+      return 0;
+    }
+  }
+
+  stop_req = false;
+  th = thread( &Telemetry::run, this );
+  return 1;
+}
+
+void Telemetry::stop()
+{
+  if( ! th.joinable() ) {
+    return;
+  }
+  stop_req = true;
+  th.join();
+  if( ! file_fn.empty() ) { // final values
+    writeFile();
+  }
+  if( sock_fd >= 0 ) {
+    close( sock_fd ); sock_fd = -1;
+    unlink( sock_fn.c_str() );
+  }
+}
+
+// exporter thread: file every period, answer to socket clients at once
+void Telemetry::run()
+{
+  auto t_next = chrono::steady_clock::now() + chrono::milliseconds( period_ms );
+  const int poll_ms = 50; // to see stop_req
+  while( ! stop_req.load( memory_order_relaxed ) ) {
+    if( sock_fd >= 0 ) {
+      pollfd pfd = { sock_fd, POLLIN, 0 };
+      if( poll( &pfd, 1, poll_ms ) > 0 && ( pfd.revents & POLLIN ) ) {
+        int c_fd = accept4( sock_fd, nullptr, nullptr, SOCK_CLOEXEC );
+        if( c_fd >= 0 ) {
+          const string s = text();
+          for( size_t off = 0; off < s.size(); ) {
+            ssize_t w = send( c_fd, s.data() + off, s.size() - off, MSG_NOSIGNAL );
+            if( w <= 0 ) {
+              break;
+            }
+            off += w;
+          }
+          close( c_fd );
+        }
+      }
+    } else {
+      this_thread::sleep_for( chrono::milliseconds( poll_ms ) );
+    }
+
+    if( chrono::steady_clock::now() >= t_next ) {
+      t_next += chrono::milliseconds( period_ms );
+      if( ! file_fn.empty() ) {
+        writeFile();
+      }
+      snap_req.store( true, memory_order_relaxed );
+    }
+  }
+}
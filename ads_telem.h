@@ -0,0 +1,82 @@
+#ifndef _ADS_TELEM_H
+#define _ADS_TELEM_H
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <thread>
+
+// Counters and gauges of the running program, written as Prometheus text
+// to file (rewritten every period) and to every client of Unix socket.
+// Counters of the acquisition loop have one writer thread: add() is relaxed
+// load + store, no locked instructions there. Counters with more writers
+// (OUT_BYTES: main thread and -j coordinator) go by addShared(), fetch_add.
+// Gauges: the last store wins.
+// Values, which need work to get (percentiles, queue depths), are published
+// by the acquisition loop, when snapReq() is set by the exporter thread.
+class Telemetry {
+  public:
+   enum Id {
+     LINES = 0,
+     DRDY_TIMEOUTS,
+     SCHED_MISSED,
+     SCHED_SKIPPED,
+     LATE_P50,
+     LATE_P99,
+     LATE_P999,
+     LATE_SUM,
+     LATE_COUNT,
+     LATE_MAX,
+     SPI_BYTES,
+     OUT_BYTES,
+     PSD_QUEUE,
+     PSD_DROPPED,
+     POOL_QUEUE,
+     POOL_DROPPED,
+     GAIN_SWITCHES,
+     SAMPLES_LOST,
+     RECOVERIES,
+     RECOVER_FAILED,
+     START_TIME,
+     ID_NUM
+   };
+   enum Type { COUNTER = 0, GAUGE, SUMMARY };
+   struct MetricInfo {
+     Id id;
+     const char *name;
+     const char *labels; // may be empty
+     Type type;
+     const char *help;   // empty: the same metric family as previous one
+   };
+
+   Telemetry();
+   ~Telemetry();
+   void add( Id id, uint64_t v = 1 ) {
+     cnt[id].store( cnt[id].load( std::memory_order_relaxed ) + v, std::memory_order_relaxed );
+   }
+   void addShared( Id id, uint64_t v ) { cnt[id].fetch_add( v, std::memory_order_relaxed ); }
+   void setCnt( Id id, uint64_t v ) { cnt[id].store( v, std::memory_order_relaxed ); }
+   void set( Id id, double v ) { gauge[id].store( v, std::memory_order_relaxed ); }
+   bool snapReq() const { return snap_req.load( std::memory_order_relaxed ); }
+   void snapDone() { snap_req.store( false, std::memory_order_relaxed ); }
+   int  start( const std::string &a_file_fn, const std::string &a_sock_fn, unsigned a_period_ms = 1000 );
+   void stop();
+   bool isActive() const { return th.joinable(); }
+   std::string text() const; // Prometheus text format
+   int  writeFile() const;   // tmp + rename
+  protected:
+   static const MetricInfo info[ID_NUM];
+   std::atomic<uint64_t> cnt[ID_NUM];
+   std::atomic<double> gauge[ID_NUM];
+   std::atomic<bool> snap_req { true }, stop_req { false };
+   std::string file_fn, sock_fn;
+   unsigned period_ms = 1000;
+   int sock_fd = -1;
+   std::thread th;
+
+   void run();
+};
+
+extern Telemetry telem;
+
+#endif
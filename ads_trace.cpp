@@ -0,0 +1,210 @@
+#include <cstring>
+#include <iostream>
+#include <fstream>
+
+#include <time.h>
+
+#include "ads_trace.h"
+
+using namespace std;
+
+int io_mode = IO_DIRECT;
+IoTrace io_trace( 0 );
+
+static const char trace_magic[8] = "ADSTRC1";
+
+static inline uint64_t mono_ns()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+IoTrace::IoTrace( unsigned cap_log2 )
+  : ring( 1ull << cap_log2 ), mask( ( 1ull << cap_log2 ) - 1 )
+{
+}
+
+void IoTrace::startRecord( unsigned cap_log2 )
+{
+  ring.assign( 1ull << cap_log2, Ev() );
+  mask = ( 1ull << cap_log2 ) - 1;
+  wr_idx = 0;
+  t_first = t_last = mono_ns();
+  need_dump = false;
+  io_mode = IO_RECORD;
+}
+
+void IoTrace::push( uint8_t type, uint8_t a, uint8_t b )
+{
+  const uint64_t t = mono_ns();
+  const uint64_t dt = t - t_last;
+  t_last = t;
+  Ev &e = ring[ wr_idx & mask ];
+  e.dt = ( dt > 0xFFFFFFFFull ) ? 0xFFFFFFFF : (uint32_t)(dt);
+  e.type = type; e.a = a; e.b = b; e.n = 0;
+  ++wr_idx;
+}
+
+uint8_t IoTrace::spi( uint8_t v )
+{
+  if( io_mode == IO_REPLAY ) {
+    const Ev *e = next( EV_SPI );
+    if( ! e ) {
+      return 0;
+    }
+    if( e->a != v ) {
+      if( ! diverged++ ) {
+        first_div = rep_pos - 1;
+      }
+    }
+    return e->b;
+  }
+  uint8_t r = io_tr->spi( v );
+  push( EV_SPI, v, r );
+  return r;
+}
+
+void IoTrace::gpio_w( uint8_t pin, uint8_t on )
+{
+  if( io_mode == IO_REPLAY ) {
+    const Ev *e = next( EV_GPIO_W );
+    if( e && ( e->a != pin || e->b != on ) ) {
+      if( ! diverged++ ) {
+        first_div = rep_pos - 1;
+      }
+    }
+    return;
+  }
+  io_tr->gpioWrite( pin, on );
+  push( EV_GPIO_W, pin, on );
+}
+
+uint8_t IoTrace::gpio_r( uint8_t pin )
+{
+  if( io_mode == IO_REPLAY ) {
+    if( rep_left > 0 ) {
+      --rep_left;
+      return rep[rep_pos-1].b;
+    }
+    const Ev *e = next( EV_GPIO_R );
+    if( ! e ) {
+      return HIGH; // DRDY: not ready
+    }
+    rep_left = e->n;
+    return e->b;
+  }
+  uint8_t r = io_tr->gpioLev( pin );
+  if( wr_idx > 0 ) { // only level changes are new events
+    Ev &l = ring[ ( wr_idx - 1 ) & mask ];
+    if( l.type == EV_GPIO_R && l.a == pin && l.b == r && l.n < 255 ) {
+      ++l.n;
+      return r;
+    }
+  }
+  push( EV_GPIO_R, pin, r );
+  return r;
+}
+
+/*
+ *  name: IoTrace::replayHasRead
+ *  function: DRDY wait in replay takes as many level reads as were recorded,
+ *            real time and number of loop iterations do not matter
+ *  The return value: true - next event (marks skipped) is GPIO read
+ */
+bool IoTrace::replayHasRead()
+{
+  if( rep_left > 0 ) {
+    return true;
+  }
+  uint64_t p = rep_pos;
+  while( p < rep.size() && rep[p].type == EV_MARK ) {
+    ++p;
+  }
+  if( p >= rep.size() ) {
+    rep_end = true;
+    return false;
+  }
+  return rep[p].type == EV_GPIO_R;
+}
+
+void IoTrace::mark( uint8_t code, uint8_t arg )
+{
+  push( EV_MARK, code, arg );
+  if( code == MARK_DRDY_TIMEOUT ) {
+    need_dump = true;
+  }
+}
+
+/*
+ *  name: IoTrace::next
+ *  function: get next recorded event for replay, marks are skipped
+ *  The return value: event or nullptr at the end of trace
+ */
+const IoTrace::Ev* IoTrace::next( uint8_t type )
+{
+  rep_left = 0;
+  while( rep_pos < rep.size() && rep[rep_pos].type == EV_MARK ) {
+    ++rep_pos;
+  }
+  if( rep_pos >= rep.size() ) {
+    rep_end = true;
+    return nullptr;
+  }
+  const Ev *e = &rep[rep_pos++];
+  if( e->type != type ) {
+    if( ! diverged++ ) {
+      first_div = rep_pos - 1;
+    }
+  }
+  return e;
+}
+
+int IoTrace::dump( const string &fn ) const
+{
+  ofstream os( fn, ios::binary );
+  if( ! os ) {
+    cerr << "Error: fail to open trace file \"" << fn << "\"" << endl;
+    return 0;
+  }
+  const uint64_t n = size();
+  const uint64_t i0 = wr_idx - n;
+
+  Hdr h;
+  memcpy( h.magic, trace_magic, sizeof(h.magic) );
+  h.n = n;
+  h.flags = ( i0 > 0 ) ? flag_wrapped : 0;
+  uint64_t t = t_last; // time of first dumped event: back from the last one
+  for( uint64_t i = i0+1; i < wr_idx; ++i ) {
+    t -= ring[ i & mask ].dt;
+  }
+  h.t0_ns = ( i0 > 0 ) ? t : t_first;
+
+  os.write( (const char*)(&h), sizeof(h) );
+  for( uint64_t i = i0; i < wr_idx; ++i ) {
+    os.write( (const char*)(&ring[ i & mask ]), sizeof(Ev) );
+  }
+  return os.good() ? 1 : 0;
+}
+
+int IoTrace::startReplay( const string &fn )
+{
+  ifstream is( fn, ios::binary );
+  Hdr h;
+  if( ! is.read( (char*)(&h), sizeof(h) ) || memcmp( h.magic, trace_magic, sizeof(h.magic) ) != 0 ) {
+    cerr << "Error: bad trace file \"" << fn << "\"" << endl;
+    return 0;
+  }
+  rep.resize( h.n );
+  if( h.n > 0 && ! is.read( (char*)(rep.data()), h.n * sizeof(Ev) ) ) {
+    cerr << "Error: short trace file \"" << fn << "\"" << endl;
+    return 0;
+  }
+  if( h.flags & flag_wrapped ) {
+    cerr << "Warning: trace \"" << fn << "\" starts in the middle, replay may diverge" << endl;
+  }
+  rep_pos = 0; rep_left = 0; rep_end = false;
+  diverged = 0; first_div = 0;
+  io_mode = IO_REPLAY;
+  return 1;
+}
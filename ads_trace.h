@@ -0,0 +1,151 @@
+#ifndef _ADS_TRACE_H
+#define _ADS_TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <bcm2835.h>
+
+#include "ads_telem.h"
+#include "ads_io.h"
+
+// Recording of SPI/GPIO activity of ADS1256 driver into binary ring
+// and replay of recorded trace instead of real hardware.
+
+enum IoMode {
+  IO_DIRECT = 0, // transport only
+  IO_RECORD,     // transport + trace
+  IO_REPLAY      // trace only, no hardware
+};
+
+class IoTrace {
+  public:
+   enum EvType : uint8_t {
+     EV_SPI    = 1, // a - out byte, b - in byte
+     EV_GPIO_W = 2, // a - pin, b - level
+     EV_GPIO_R = 3, // a - pin, b - level, n - repeats of same read
+     EV_MARK   = 4  // a - mark code, b - arg
+   };
+   enum MarkCode : uint8_t {
+     MARK_USER = 0,
+     MARK_DRDY_TIMEOUT = 1,
+     MARK_LINE = 2,
+     MARK_RECOVER = 3  // arg: 1 - soft, 2 - hard reset
+   };
+   struct Ev { // 8 bytes
+     uint32_t dt; // ns from previous event, saturated
+     uint8_t  type, a, b, n;
+   };
+   struct Hdr {
+     char     magic[8];
+     uint32_t n;     // events
+     uint32_t flags; // bit0: ring was wrapped, start lost
+     uint64_t t0_ns; // CLOCK_MONOTONIC of first event
+   };
+   static const uint32_t flag_wrapped = 1;
+
+   explicit IoTrace( unsigned cap_log2 = 18 );
+   void startRecord( unsigned cap_log2 = 18 );
+   int  startReplay( const std::string &fn );
+   uint8_t spi( uint8_t v );
+   void gpio_w( uint8_t pin, uint8_t on );
+   uint8_t gpio_r( uint8_t pin );
+   void mark( uint8_t code, uint8_t arg = 0 );
+   int  dump( const std::string &fn ) const;
+   bool needDump() const { return need_dump; }
+   void clearNeedDump() { need_dump = false; }
+   uint64_t size() const { return ( wr_idx > mask ) ? ( mask + 1 ) : wr_idx; }
+   // replay state
+   bool ended() const { return rep_end; }
+   bool replayHasRead(); // next recorded event is GPIO read: DRDY wait goes on
+   uint64_t getReplayPos() const { return rep_pos; }
+   uint64_t getDiverged() const { return diverged; }
+   uint64_t getFirstDiverged() const { return first_div; }
+  protected:
+   std::vector<Ev> ring;
+   uint64_t mask;
+   uint64_t wr_idx = 0;  // total recorded events
+   uint64_t t_first = 0, t_last = 0; // ns, first evt ever, last evt
+   bool need_dump = false;
+   // replay
+   std::vector<Ev> rep;
+   uint64_t rep_pos = 0;
+   unsigned rep_left = 0; // repeats of current EV_GPIO_R
+   bool rep_end = false;
+   uint64_t diverged = 0, first_div = 0;
+
+   void push( uint8_t type, uint8_t a, uint8_t b );
+   const Ev* next( uint8_t type );
+};
+
+extern int io_mode;
+extern IoTrace io_trace;
+
+inline uint8_t io_spi_transfer( uint8_t v )
+{
+  telem.add( Telemetry::SPI_BYTES );
+  if( io_mode == IO_DIRECT ) {
+    return io_tr->spi( v );
+  }
+  return io_trace.spi( v );
+}
+
+inline void io_gpio_write( uint8_t pin, uint8_t on )
+{
+  if( io_mode == IO_DIRECT ) {
+    io_tr->gpioWrite( pin, on );
+    return;
+  }
+  io_trace.gpio_w( pin, on );
+}
+
+inline uint8_t io_gpio_lev( uint8_t pin )
+{
+  if( io_mode == IO_DIRECT ) {
+    return io_tr->gpioLev( pin );
+  }
+  return io_trace.gpio_r( pin );
+}
+
+// one command (bytes and delays of parts) under CS held by caller:
+// transport may send it at once (spidev: one ioctl), trace needs single bytes
+inline int io_cmd( const IoXfer *x, unsigned n )
+{
+  if( io_mode == IO_DIRECT ) {
+    unsigned n_bytes = 0;
+    for( unsigned k=0; k<n; ++k ) {
+      n_bytes += x[k].len;
+    }
+    telem.add( Telemetry::SPI_BYTES, n_bytes );
+    return io_tr->cmd( x, n );
+  }
+  for( unsigned k=0; k<n; ++k ) {
+    for( unsigned i=0; i<x[k].len; ++i ) {
+      const uint8_t r = io_spi_transfer( x[k].tx ? x[k].tx[i] : 0xFF );
+      if( x[k].rx ) {
+        x[k].rx[i] = r;
+      }
+    }
+    if( x[k].delay_us && io_mode != IO_REPLAY ) {
+      io_tr->delayUs( x[k].delay_us );
+    }
+  }
+  return 1;
+}
+
+// batch of n_bytes in parts: only IO_DIRECT, trace needs single bytes
+inline int io_xfer( const IoXfer *x, unsigned n, unsigned n_bytes )
+{
+  telem.add( Telemetry::SPI_BYTES, n_bytes );
+  return io_tr->xfer( x, n );
+}
+
+inline void io_mark( uint8_t code, uint8_t arg = 0 )
+{
+  if( io_mode == IO_RECORD ) {
+    io_trace.mark( code, arg );
+  }
+}
+
+#endif
@@ -1,18 +1,186 @@
-#ifndef __arm__
-
+#define _DEFAULT_SOURCE
 #include <bcm2835.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Very simple model of ADS1256 on SPI: registers (RREG/WREG), chip ID,
+// RDATA with synthetic codes, DRDY always ready (polling it completes conversion).
+// Codes are deterministic: channel level + small pseudo-noise.
+// Always linked: the "fake" transport calls bcm_fake_* directly (also on Pi);
+// with BCM_FAKE (not Pi) it stands in for libbcm2835 as well.
+
+int bcm_fake_delay = 1; // 0 - skip all delays (bench, replay), env BCM_FAKE_DELAY
+
+// fault injection, env BCM_FAKE_FAULT=n:mode - after n RDATA commands:
+// mode 1 - DRDY stays high until SDATAC (soft recovery; WAKEUP of every read
+//          does not help) or RST, 2 - DRDY high until RST pin pulse,
+// 3 - MISO stuck at 1 until RST pin pulse
+static unsigned f_fault_at = 0, f_fault_mode = 0, f_fault = 0;
+
+// test tone, env BCM_FAKE_TONE=period - square wave of +-0x8000 codes (x gain)
+// with period in RDATA commands (-c 1: in samples) added to all channels
+static unsigned f_tone = 0;
+
+enum FakeState { F_IDLE, F_WREG_N, F_WREG, F_RREG_N, F_RREG, F_RDATA };
+
+static const uint8_t fake_regs_def[11] = { 0x31, 0x01, 0x20, 0xF0, 0xE0, 0, 0, 0, 0, 0, 0x40 };
+static uint8_t  fake_regs[11] = { 0x31, 0x01, 0x20, 0xF0, 0xE0, 0, 0, 0, 0, 0, 0x40 };
+static int      f_st = F_IDLE;
+static unsigned f_reg, f_n, f_di;
+static uint8_t  f_data[3];
+static uint8_t  f_conv_mux = 0x01, f_data_mux = 0x01;
+static uint8_t  f_conv_gain = 0, f_data_gain = 0;
+static int      f_synced = 0;
+static uint32_t f_cnt = 0;
+
+static int32_t fake_code( uint8_t mux, uint8_t gain )
+{
+  int32_t ch = ( mux >> 4 ) & 0x07;
+  int32_t v  = 0x10000 + ch * 0x80000 / 8;
+  if( f_tone ) {
+    v += ( f_cnt % f_tone < f_tone / 2 ) ? 0x8000 : -0x8000;
+  }
+  v <<= gain;
+  v += (int32_t)( ( f_cnt * 2654435761u ) >> 26 ) - 32;
+  if( v > 0x7FFFFF ) {
+    v = 0x7FFFFF;
+  }
+  return v;
+}
+
+static void fake_cmd( uint8_t v )
+{
+  if( ( v & 0xF0 ) == 0x50 ) {
+    f_reg = v & 0x0F; f_st = F_WREG_N;
+  } else if( ( v & 0xF0 ) == 0x10 ) {
+    f_reg = v & 0x0F; f_st = F_RREG_N;
+  } else if( v == 0x01 ) { // RDATA
+    if( f_fault_at && f_cnt + 1 == f_fault_at ) {
+      f_fault = f_fault_mode;
+    }
+    if( ! f_synced ) {
+      f_data_mux = f_conv_mux; f_data_gain = f_conv_gain;
+    }
+    f_synced = 0;
+    int32_t c = fake_code( f_data_mux, f_data_gain );
+    f_data[0] = c >> 16; f_data[1] = c >> 8; f_data[2] = c;
+    f_di = 0; f_st = F_RDATA;
+    ++f_cnt;
+  } else if( v == 0x0F ) { // SDATAC
+    if( f_fault == 1 ) {
+      f_fault = 0;
+    }
+  } else if( v == 0x00 ) { // WAKEUP: old conversion in data reg, new starts
+    f_data_mux = f_conv_mux; f_data_gain = f_conv_gain;
+    f_conv_mux = fake_regs[1]; f_conv_gain = fake_regs[2] & 0x07;
+    f_synced = 1;
+  } else if( v == 0xFE ) { // RESET
+    for( int i=0; i<11; ++i ) {
+      fake_regs[i] = fake_regs_def[i];
+    }
+  }
+}
+
+void bcm_fake_gpio_write( uint8_t pin, uint8_t on )
+{
+  if( pin == RPI_GPIO_P1_24 && on ) { // CS high: end of transaction
+    f_st = F_IDLE;
+  }
+  if( pin == RPI_GPIO_P1_12 && ! on ) { // RST low: power-up state
+    for( int i=0; i<11; ++i ) {
+      fake_regs[i] = fake_regs_def[i];
+    }
+    f_st = F_IDLE; f_fault = 0;
+  }
+}
+
+uint8_t bcm_fake_gpio_lev( uint8_t pin )
+{
+  if( pin == RPI_GPIO_P1_11 ) { // DRDY low: conversion after WAKEUP is done
+    if( f_fault == 1 || f_fault == 2 ) {
+      return 1;
+    }
+    f_synced = 0;
+  }
+  return 0;
+}
+
+uint8_t bcm_fake_spi_transfer( uint8_t value )
+{
+  uint8_t r = 0;
+  switch( f_st ) {
+    case F_WREG_N:
+      f_n = ( value & 0x0F ) + 1; f_st = F_WREG;
+      break;
+    case F_WREG:
+      if( f_reg == 0 ) {
+        fake_regs[0] = ( fake_regs[0] & 0xF1 ) | ( value & 0x0E );
+      } else if( f_reg < 11 ) {
+        fake_regs[f_reg] = value;
+      }
+      ++f_reg;
+      if( --f_n == 0 ) { f_st = F_IDLE; }
+      break;
+    case F_RREG_N:
+      f_n = ( value & 0x0F ) + 1; f_st = F_RREG;
+      break;
+    case F_RREG:
+      r = ( f_reg < 11 ) ? fake_regs[f_reg] : 0;
+      ++f_reg;
+      if( --f_n == 0 ) { f_st = F_IDLE; }
+      break;
+    case F_RDATA:
+      r = f_data[f_di++];
+      if( f_di >= 3 ) { f_st = F_IDLE; }
+      break;
+    default:
+      fake_cmd( value );
+      break;
+  }
+  if( f_fault == 3 ) {
+    return 0xFF;
+  }
+  return r;
+}
+
+void bcm_fake_delay_us( uint64_t micros )
+{
+  if( bcm_fake_delay ) {
+    usleep( micros );
+  }
+}
+
+void bcm_fake_init(void)
+{
+  const char *e = getenv( "BCM_FAKE_DELAY" );
+  if( e ) {
+    bcm_fake_delay = atoi( e );
+  }
+  e = getenv( "BCM_FAKE_FAULT" );
+  if( e ) {
+    sscanf( e, "%u:%u", &f_fault_at, &f_fault_mode );
+  }
+  e = getenv( "BCM_FAKE_TONE" );
+  if( e ) {
+    f_tone = atoi( e );
+  }
+}
+
+#ifdef BCM_FAKE
 
-void bcm2835_gpio_write( uint8_t pin, uint8_t on ){}
-uint8_t bcm2835_gpio_lev( uint8_t pin ) { return 0;}
-int bcm2835_spi_begin(void) { return 0; };
+void bcm2835_gpio_write( uint8_t pin, uint8_t on ) { bcm_fake_gpio_write( pin, on ); }
+uint8_t bcm2835_gpio_lev( uint8_t pin ) { return bcm_fake_gpio_lev( pin ); }
+uint8_t bcm2835_spi_transfer( uint8_t value ) { return bcm_fake_spi_transfer( value ); }
+void bcm2835_delayMicroseconds( uint64_t micros ) { bcm_fake_delay_us( micros ); }
+int bcm2835_init(void) { bcm_fake_init(); return 1; };
+int bcm2835_spi_begin(void) { return 1; };
 void bcm2835_spi_setBitOrder( uint8_t order ) {};
 void bcm2835_spi_setDataMode( uint8_t mode ) {};
 void bcm2835_spi_setClockDivider( uint16_t divider ) {};
 void bcm2835_gpio_fsel( uint8_t pin, uint8_t mode ) {};
 void bcm2835_gpio_set_pud( uint8_t pin, uint8_t pud ) {};
-uint8_t bcm2835_spi_transfer( uint8_t value ) { return 0; };
-int bcm2835_init(void) { return 0; };
 void bcm2835_spi_end(void) {};
 int bcm2835_close(void) { return 1; };
 